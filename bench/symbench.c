@@ -0,0 +1,758 @@
+/*
+ * symbench.c
+ *
+ * Benchmark of symdep on synthetic ROM trees.
+ * Generates ELF32 and/or ELF64 shared objects with configurable counts of
+ * DT_NEEDED entries, imports, exports and chain depth, runs symdep against
+ * them and reports wall time, throughput and peak RSS.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <elf.h>
+#include <ftw.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define HASH_NONE	0
+#define HASH_GNU	1
+#define HASH_SYSV	2
+
+struct buf {
+    unsigned char *data;
+    size_t size, cap;
+};
+
+struct export {
+    uint32_t hash;
+    uint32_t name;		/* Offset in .dynstr */
+    size_t index;		/* Position in .text */
+};
+
+/* Shape of generated tree */
+static unsigned int g_levels = 4, g_libs = 50, g_needed = 4, g_imports = 200,
+	g_exports = 400, g_missing = 1, g_runs = 3;
+static int g_hash = HASH_GNU;
+static uint32_t g_seed = 1;
+static uint32_t g_nbuckets;
+
+static uint32_t rnd(void) {
+
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+static size_t buf_add(struct buf *b, const void *data, size_t size) {
+
+    size_t offset = b->size;
+
+    if (b->size + size > b->cap) {
+	b->cap = (b->size + size) * 2 + 256;
+	b->data = realloc(b->data, b->cap);
+	if (b->data == NULL) {
+	    perror("realloc");
+	    exit(ENOMEM);
+	}
+    }
+    if (data != NULL)
+	memcpy(b->data + b->size, data, size);
+    else
+	memset(b->data + b->size, 0, size);
+    b->size += size;
+
+    return offset;
+}
+
+static void buf_align(struct buf *b, size_t align) {
+
+    if (b->size % align)
+	buf_add(b, NULL, align - b->size % align);
+}
+
+static inline uint32_t gnu_hash(const unsigned char *name) {
+
+    uint32_t h = 5381;
+
+    while (*name != '\0')
+	h = (h << 5) + h + *name++;
+
+    return h;
+}
+
+static inline uint32_t elf_hash(const unsigned char *name) {
+
+    uint32_t h = 0, g;
+
+    while (*name != '\0') {
+	h = (h << 4) + *name++;
+	g = h & 0xf0000000;
+	if (g)
+	    h ^= g >> 24;
+	h &= ~g;
+    }
+
+    return h;
+}
+
+static int cmp_bucket(const void *a, const void *b) {
+
+    const struct export *x = a, *y = b;
+    uint32_t bx = x->hash % g_nbuckets, by = y->hash % g_nbuckets;
+
+    return bx < by ? -1 : bx > by;
+}
+
+static void put_sym(struct buf *b, uint8_t elf_class, uint32_t name, uint64_t value,
+			uint64_t size, uint8_t info, uint16_t shndx)
+{
+    if (elf_class == ELFCLASS32) {
+	Elf32_Sym sym = { name, value, size, info, STV_DEFAULT, shndx };
+	buf_add(b, &sym, sizeof(sym));
+    }
+    else {
+	Elf64_Sym sym = { name, info, STV_DEFAULT, shndx, value, size };
+	buf_add(b, &sym, sizeof(sym));
+    }
+}
+
+static void put_dyn(struct buf *b, uint8_t elf_class, int64_t tag, uint64_t val) {
+
+    if (elf_class == ELFCLASS32) {
+	Elf32_Dyn dyn = { tag, { val } };
+	buf_add(b, &dyn, sizeof(dyn));
+    }
+    else {
+	Elf64_Dyn dyn = { tag, { val } };
+	buf_add(b, &dyn, sizeof(dyn));
+    }
+}
+
+static void put_shdr(struct buf *b, uint8_t elf_class, uint32_t name, uint32_t type, uint64_t flags,
+			uint64_t offset, uint64_t size, uint32_t link, uint32_t info, uint64_t entsize)
+{
+    if (elf_class == ELFCLASS32) {
+	Elf32_Shdr shdr = { name, type, flags, offset, offset, size, link, info, 8, entsize };
+	buf_add(b, &shdr, sizeof(shdr));
+    }
+    else {
+	Elf64_Shdr shdr = { name, type, flags, offset, offset, size, link, info, 8, entsize };
+	buf_add(b, &shdr, sizeof(shdr));
+    }
+}
+
+static void put_phdr(struct buf *b, uint8_t elf_class, uint32_t type, uint64_t offset, uint64_t size) {
+
+    if (elf_class == ELFCLASS32) {
+	Elf32_Phdr phdr = { type, offset, offset, offset, size, size, PF_R | PF_X, 8 };
+	buf_add(b, &phdr, sizeof(phdr));
+    }
+    else {
+	Elf64_Phdr phdr = { type, PF_R | PF_X, offset, offset, offset, size, size, 8 };
+	buf_add(b, &phdr, sizeof(phdr));
+    }
+}
+
+/* Write shared object with given needed libs, imports and exports.
+ * Sections are laid out so that file offset equals virtual address
+ */
+static int write_object(const char *path, uint8_t elf_class, const char *soname,
+			char **needed, size_t needed_cnt, char **imports, size_t import_cnt,
+			char **exports, size_t export_cnt)
+{
+    struct buf file = { 0 }, dynstr = { 0 }, dynsym = { 0 }, hash = { 0 }, dynamic = { 0 }, shstrtab = { 0 };
+    struct export *exp;
+    size_t i, sym_cnt = 1 + import_cnt + export_cnt, ehdr_size, phdr_size, shdr_size, word_size;
+    size_t off_dynsym, off_dynstr, off_hash = 0, off_text, off_dynamic, off_shstrtab, off_shdr, text_size;
+    uint32_t soname_off, *needed_off, *import_off, symoffset = 1 + import_cnt, sh_names[7];
+    uint16_t shnum, text_idx, dynstr_idx = 2;
+    int fd, ret = 0;
+
+    ehdr_size = elf_class == ELFCLASS32 ? sizeof(Elf32_Ehdr) : sizeof(Elf64_Ehdr);
+    phdr_size = elf_class == ELFCLASS32 ? sizeof(Elf32_Phdr) : sizeof(Elf64_Phdr);
+    shdr_size = elf_class == ELFCLASS32 ? sizeof(Elf32_Shdr) : sizeof(Elf64_Shdr);
+    word_size = elf_class == ELFCLASS32 ? 4 : 8;
+
+    /* .dynstr */
+    buf_add(&dynstr, "", 1);
+    soname_off = buf_add(&dynstr, soname, strlen(soname) + 1);
+    needed_off = calloc(needed_cnt + 1, sizeof(uint32_t));
+    import_off = calloc(import_cnt + 1, sizeof(uint32_t));
+    exp = calloc(export_cnt + 1, sizeof(struct export));
+    if (needed_off == NULL || import_off == NULL || exp == NULL)
+	return -ENOMEM;
+    for (i = 0; i < needed_cnt; i++)
+	needed_off[i] = buf_add(&dynstr, needed[i], strlen(needed[i]) + 1);
+    for (i = 0; i < import_cnt; i++)
+	import_off[i] = buf_add(&dynstr, imports[i], strlen(imports[i]) + 1);
+    for (i = 0; i < export_cnt; i++) {
+	exp[i].name = buf_add(&dynstr, exports[i], strlen(exports[i]) + 1);
+	exp[i].hash = g_hash == HASH_SYSV ? elf_hash((unsigned char *)exports[i])
+					    : gnu_hash((unsigned char *)exports[i]);
+	exp[i].index = i;
+    }
+
+    /* .gnu.hash wants exports grouped by bucket */
+    g_nbuckets = export_cnt / 4 + 1;
+    if (g_hash == HASH_GNU)
+	qsort(exp, export_cnt, sizeof(struct export), cmp_bucket);
+
+    /* Layout */
+    text_idx = g_hash == HASH_NONE ? 3 : 4;
+    shnum = text_idx + 3;
+    buf_add(&file, NULL, ehdr_size + 2 * phdr_size);
+    buf_align(&file, 8);
+    off_dynsym = file.size;
+    file.size += sym_cnt * (elf_class == ELFCLASS32 ? sizeof(Elf32_Sym) : sizeof(Elf64_Sym));
+    off_dynstr = file.size;
+    file.size += dynstr.size;
+
+    if (g_hash == HASH_GNU) {
+	uint32_t header[4], bloom_size = 1, shift = elf_class == ELFCLASS32 ? 5 : 6;
+	uint32_t *buckets, *chain;
+	uint64_t *bloom;
+
+	while (bloom_size * word_size * 8 < export_cnt * 2)
+	    bloom_size *= 2;
+	bloom = calloc(bloom_size, sizeof(uint64_t));
+	buckets = calloc(g_nbuckets, sizeof(uint32_t));
+	chain = calloc(export_cnt + 1, sizeof(uint32_t));
+	if (bloom == NULL || buckets == NULL || chain == NULL)
+	    return -ENOMEM;
+
+	for (i = 0; i < export_cnt; i++) {
+	    uint32_t h = exp[i].hash, bits = word_size * 8, b = h % g_nbuckets;
+
+	    bloom[(h / bits) & (bloom_size - 1)] |= (1ULL << (h % bits)) | (1ULL << ((h >> shift) % bits));
+	    if (buckets[b] == 0)
+		buckets[b] = symoffset + i;
+	    chain[i] = h & ~1U;
+	    /* Last symbol in bucket */
+	    if (i + 1 == export_cnt || exp[i + 1].hash % g_nbuckets != b)
+		chain[i] |= 1;
+	}
+
+	header[0] = g_nbuckets;
+	header[1] = symoffset;
+	header[2] = bloom_size;
+	header[3] = shift;
+	buf_add(&hash, header, sizeof(header));
+	for (i = 0; i < bloom_size; i++)
+	    if (elf_class == ELFCLASS32) {
+		uint32_t word = bloom[i];
+		buf_add(&hash, &word, sizeof(word));
+	    }
+	    else
+		buf_add(&hash, &bloom[i], sizeof(uint64_t));
+	buf_add(&hash, buckets, g_nbuckets * sizeof(uint32_t));
+	buf_add(&hash, chain, export_cnt * sizeof(uint32_t));
+	free(bloom);
+	free(buckets);
+	free(chain);
+    }
+    else if (g_hash == HASH_SYSV) {
+	uint32_t header[2] = { g_nbuckets, sym_cnt }, *buckets, *chain, b;
+
+	buckets = calloc(g_nbuckets, sizeof(uint32_t));
+	chain = calloc(sym_cnt, sizeof(uint32_t));
+	if (buckets == NULL || chain == NULL)
+	    return -ENOMEM;
+	for (i = 0; i < export_cnt; i++) {
+	    b = exp[i].hash % g_nbuckets;
+	    chain[symoffset + i] = buckets[b];
+	    buckets[b] = symoffset + i;
+	}
+	buf_add(&hash, header, sizeof(header));
+	buf_add(&hash, buckets, g_nbuckets * sizeof(uint32_t));
+	buf_add(&hash, chain, sym_cnt * sizeof(uint32_t));
+	free(buckets);
+	free(chain);
+    }
+
+    if (g_hash != HASH_NONE) {
+	buf_align(&file, 8);
+	off_hash = file.size;
+	file.size += hash.size;
+    }
+
+    buf_align(&file, 16);
+    off_text = file.size;
+    text_size = export_cnt ? export_cnt * 16 : 16;
+    file.size += text_size;
+
+    /* .dynamic */
+    for (i = 0; i < needed_cnt; i++)
+	put_dyn(&dynamic, elf_class, DT_NEEDED, needed_off[i]);
+    put_dyn(&dynamic, elf_class, DT_SONAME, soname_off);
+    if (g_hash == HASH_GNU)
+	put_dyn(&dynamic, elf_class, DT_GNU_HASH, off_hash);
+    else if (g_hash == HASH_SYSV)
+	put_dyn(&dynamic, elf_class, DT_HASH, off_hash);
+    put_dyn(&dynamic, elf_class, DT_STRTAB, off_dynstr);
+    put_dyn(&dynamic, elf_class, DT_SYMTAB, off_dynsym);
+    put_dyn(&dynamic, elf_class, DT_STRSZ, dynstr.size);
+    put_dyn(&dynamic, elf_class, DT_SYMENT, elf_class == ELFCLASS32 ? sizeof(Elf32_Sym) : sizeof(Elf64_Sym));
+    put_dyn(&dynamic, elf_class, DT_NULL, 0);
+
+    buf_align(&file, 8);
+    off_dynamic = file.size;
+    file.size += dynamic.size;
+
+    /* .shstrtab */
+    buf_add(&shstrtab, "", 1);
+    sh_names[1] = buf_add(&shstrtab, ".dynsym", 8);
+    sh_names[2] = buf_add(&shstrtab, ".dynstr", 8);
+    sh_names[3] = g_hash == HASH_GNU ? buf_add(&shstrtab, ".gnu.hash", 10) : buf_add(&shstrtab, ".hash", 6);
+    sh_names[4] = buf_add(&shstrtab, ".text", 6);
+    sh_names[5] = buf_add(&shstrtab, ".dynamic", 9);
+    sh_names[6] = buf_add(&shstrtab, ".shstrtab", 10);
+    off_shstrtab = file.size;
+    file.size += shstrtab.size;
+
+    file.size = (file.size + 7) & ~(size_t)7;
+    off_shdr = file.size;
+    file.size = 0;
+    buf_add(&file, NULL, off_shdr + shnum * shdr_size);
+
+    /* Contents */
+    put_sym(&dynsym, elf_class, 0, 0, 0, 0, SHN_UNDEF);
+    for (i = 0; i < import_cnt; i++)
+	put_sym(&dynsym, elf_class, import_off[i], 0, 0, ELF32_ST_INFO(STB_GLOBAL, STT_FUNC), SHN_UNDEF);
+    for (i = 0; i < export_cnt; i++)
+	put_sym(&dynsym, elf_class, exp[i].name, off_text + exp[i].index * 16, 16,
+		ELF32_ST_INFO(STB_GLOBAL, STT_FUNC), text_idx);
+    memcpy(file.data + off_dynsym, dynsym.data, dynsym.size);
+    memcpy(file.data + off_dynstr, dynstr.data, dynstr.size);
+    if (g_hash != HASH_NONE)
+	memcpy(file.data + off_hash, hash.data, hash.size);
+    memset(file.data + off_text, 0xc3, text_size);
+    memcpy(file.data + off_dynamic, dynamic.data, dynamic.size);
+    memcpy(file.data + off_shstrtab, shstrtab.data, shstrtab.size);
+
+    /* Section headers */
+    file.size = off_shdr;
+    put_shdr(&file, elf_class, 0, SHT_NULL, 0, 0, 0, 0, 0, 0);
+    put_shdr(&file, elf_class, sh_names[1], SHT_DYNSYM, SHF_ALLOC, off_dynsym, dynsym.size, dynstr_idx, 1,
+	    elf_class == ELFCLASS32 ? sizeof(Elf32_Sym) : sizeof(Elf64_Sym));
+    put_shdr(&file, elf_class, sh_names[2], SHT_STRTAB, SHF_ALLOC, off_dynstr, dynstr.size, 0, 0, 0);
+    if (g_hash != HASH_NONE)
+	put_shdr(&file, elf_class, sh_names[3], g_hash == HASH_GNU ? SHT_GNU_HASH : SHT_HASH, SHF_ALLOC,
+		off_hash, hash.size, 1, 0, 4);
+    put_shdr(&file, elf_class, sh_names[4], SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, off_text, text_size, 0, 0, 0);
+    put_shdr(&file, elf_class, sh_names[5], SHT_DYNAMIC, SHF_ALLOC | SHF_WRITE, off_dynamic, dynamic.size,
+	    dynstr_idx, 0, elf_class == ELFCLASS32 ? sizeof(Elf32_Dyn) : sizeof(Elf64_Dyn));
+    put_shdr(&file, elf_class, sh_names[6], SHT_STRTAB, 0, off_shstrtab, shstrtab.size, 0, 0, 0);
+
+    /* Program headers */
+    file.size = ehdr_size;
+    put_phdr(&file, elf_class, PT_LOAD, 0, off_shstrtab);
+    put_phdr(&file, elf_class, PT_DYNAMIC, off_dynamic, dynamic.size);
+    file.size = off_shdr + shnum * shdr_size;
+
+    /* ELF header */
+    if (elf_class == ELFCLASS32) {
+	Elf32_Ehdr *ehdr = (Elf32_Ehdr *)file.data;
+
+	ehdr->e_type = ET_DYN;
+	ehdr->e_machine = EM_ARM;
+	ehdr->e_version = EV_CURRENT;
+	ehdr->e_phoff = ehdr_size;
+	ehdr->e_shoff = off_shdr;
+	ehdr->e_ehsize = ehdr_size;
+	ehdr->e_phentsize = phdr_size;
+	ehdr->e_phnum = 2;
+	ehdr->e_shentsize = shdr_size;
+	ehdr->e_shnum = shnum;
+	ehdr->e_shstrndx = shnum - 1;
+    }
+    else {
+	Elf64_Ehdr *ehdr = (Elf64_Ehdr *)file.data;
+
+	ehdr->e_type = ET_DYN;
+	ehdr->e_machine = EM_AARCH64;
+	ehdr->e_version = EV_CURRENT;
+	ehdr->e_phoff = ehdr_size;
+	ehdr->e_shoff = off_shdr;
+	ehdr->e_ehsize = ehdr_size;
+	ehdr->e_phentsize = phdr_size;
+	ehdr->e_phnum = 2;
+	ehdr->e_shentsize = shdr_size;
+	ehdr->e_shnum = shnum;
+	ehdr->e_shstrndx = shnum - 1;
+    }
+    memcpy(file.data, ELFMAG, SELFMAG);
+    file.data[EI_CLASS] = elf_class;
+    file.data[EI_DATA] = ELFDATA2LSB;
+    file.data[EI_VERSION] = EV_CURRENT;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, file.data, file.size) != (ssize_t)file.size)
+	ret = -errno;
+    if (fd >= 0)
+	close(fd);
+
+    free(file.data);
+    free(dynstr.data);
+    free(dynsym.data);
+    free(hash.data);
+    free(dynamic.data);
+    free(shstrtab.data);
+    free(needed_off);
+    free(import_off);
+    free(exp);
+
+    return ret;
+}
+
+static char* lib_name(unsigned int level, unsigned int lib) {
+
+    char *name;
+
+    if (asprintf(&name, "libsyn%u_%u.so", level, lib) < 0) {
+	perror("asprintf");
+	exit(ENOMEM);
+    }
+
+    return name;
+}
+
+static char* sym_name(unsigned int level, unsigned int lib, unsigned int sym) {
+
+    char *name;
+
+    if (asprintf(&name, "_ZN7android3syn%uL%u6Symbol%uEPKvj", lib, level, sym) < 0) {
+	perror("asprintf");
+	exit(ENOMEM);
+    }
+
+    return name;
+}
+
+/* Libs of level L need libs of level L - 1 and import their exports,
+ * target in bin is the only object of the top level.
+ * Returns counts of objects and imports reachable at default depth and in full
+ */
+static int generate(const char *root, uint8_t elf_class, size_t *libs, size_t *syms,
+			size_t *full_libs, size_t *full_syms)
+{
+    unsigned int level, lib, k, needed_cnt, export_cnt, import_cnt;
+    char path[2 * PATH_MAX], dir[PATH_MAX], **needed, **imports, **exports;
+    unsigned int *targets;
+    uint8_t *reach, *next, *tmp;
+    int ret;
+
+    snprintf(dir, PATH_MAX, "%s/system", root);
+    mkdir(dir, 0755);
+    snprintf(dir, PATH_MAX, "%s/system/bin", root);
+    mkdir(dir, 0755);
+    snprintf(dir, PATH_MAX, "%s/system/%s", root, elf_class == ELFCLASS32 ? "lib" : "lib64");
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+	return -errno;
+
+    needed = calloc(g_needed + 1, sizeof(char *));
+    targets = calloc(g_needed + 1, sizeof(unsigned int));
+    imports = calloc(g_imports + 1, sizeof(char *));
+    exports = calloc(g_exports + 1, sizeof(char *));
+    reach = calloc(g_libs, 1);
+    next = calloc(g_libs, 1);
+    if (needed == NULL || targets == NULL || imports == NULL || exports == NULL
+	|| reach == NULL || next == NULL)
+	    return -ENOMEM;
+
+    *full_libs = 0;
+    *full_syms = 0;
+    g_seed = elf_class;
+
+    /* Level g_levels is the target itself */
+    for (level = g_levels + 1; level-- > 0; ) {
+	unsigned int lib_cnt = level == g_levels ? 1 : g_libs;
+
+	for (lib = 0; lib < lib_cnt; lib++) {
+	    /* Deepest libs need nothing */
+	    needed_cnt = level == 0 ? 0 : (g_needed < g_libs ? g_needed : g_libs);
+	    for (k = 0; k < needed_cnt; k++) {
+		targets[k] = (lib * g_needed + k) % g_libs;
+		needed[k] = lib_name(level - 1, targets[k]);
+	    }
+
+	    import_cnt = needed_cnt ? g_imports : 0;
+	    if (import_cnt > needed_cnt * g_exports)
+		import_cnt = needed_cnt * g_exports;
+	    for (k = 0; k < import_cnt; k++) {
+		if (rnd() % 100 < g_missing)
+		    imports[k] = sym_name(level, lib, g_exports + k);
+		else
+		    /* Spread imports over needed libs, never twice the same */
+		    imports[k] = sym_name(level - 1, targets[k % needed_cnt], k / needed_cnt);
+	    }
+
+	    export_cnt = level == g_levels ? 0 : g_exports;
+	    for (k = 0; k < export_cnt; k++)
+		exports[k] = sym_name(level, lib, k);
+
+	    if (level == g_levels) {
+		snprintf(path, sizeof(path), "%s/system/bin/synbin%u", root, elf_class == ELFCLASS32 ? 32 : 64);
+		*libs = 1 + needed_cnt;
+		*syms = import_cnt;
+	    }
+	    else {
+		char *name = lib_name(level, lib);
+		snprintf(path, sizeof(path), "%s/%s", dir, name);
+		free(name);
+	    }
+
+	    /* Count only what --full gets to */
+	    if (level == g_levels || reach[lib]) {
+		(*full_libs)++;
+		*full_syms += import_cnt;
+		for (k = 0; k < needed_cnt; k++)
+		    next[targets[k]] = 1;
+	    }
+
+	    ret = write_object(path, elf_class, strrchr(path, '/') + 1, needed, needed_cnt,
+				imports, import_cnt, exports, export_cnt);
+
+	    for (k = 0; k < needed_cnt; k++)
+		free(needed[k]);
+	    for (k = 0; k < import_cnt; k++)
+		free(imports[k]);
+	    for (k = 0; k < export_cnt; k++)
+		free(exports[k]);
+	    if (ret < 0)
+		return ret;
+	}
+
+	tmp = reach;
+	reach = next;
+	next = tmp;
+	memset(next, 0, g_libs);
+    }
+
+    free(reach);
+    free(next);
+    free(needed);
+    free(targets);
+    free(imports);
+    free(exports);
+
+    return 0;
+}
+
+static double now(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run symdep with output discarded */
+static int run(char **args, double *wall, long *maxrss) {
+
+    pid_t pid;
+    int status, fd;
+    struct rusage ru;
+    double start = now();
+
+    pid = fork();
+    if (pid < 0)
+	return -errno;
+    if (pid == 0) {
+	fd = open("/dev/null", O_WRONLY);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	execv(args[0], args);
+	_exit(127);
+    }
+
+    if (wait4(pid, &status, 0, &ru) < 0)
+	return -errno;
+    *wall = now() - start;
+    *maxrss = ru.ru_maxrss;
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -EINTR;
+}
+
+static int cmp_double(const void *a, const void *b) {
+
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void bench(char *symdep, const char *root, uint8_t elf_class, uint8_t full,
+			size_t libs, size_t syms, char **extra, int extra_cnt)
+{
+    char target[PATH_MAX], *args[extra_cnt + 4];
+    double wall = 0, times[g_runs];
+    long maxrss = 0, peak = 0;
+    unsigned int i;
+    int j, n = 0, ret = 0;
+
+    snprintf(target, PATH_MAX, "%s/system/bin/synbin%u", root, elf_class == ELFCLASS32 ? 32 : 64);
+    args[n++] = symdep;
+    if (full)
+	args[n++] = "--full";
+    for (j = 0; j < extra_cnt; j++)
+	args[n++] = extra[j];
+    args[n++] = target;
+    args[n] = NULL;
+
+    for (i = 0; i < g_runs; i++) {
+	ret = run(args, &wall, &maxrss);
+	if (ret < 0 || ret == 127) {
+	    printf("%s: failed to run\n", symdep);
+	    return;
+	}
+	times[i] = wall;
+	if (maxrss > peak)
+	    peak = maxrss;
+    }
+
+    /* Median is less sensitive to page cache warm up */
+    qsort(times, g_runs, sizeof(double), cmp_double);
+    wall = times[g_runs / 2];
+
+    printf("ELF%-3u %-8s %8zu %10zu %10.4f %12.0f %12.0f %10ld\n", elf_class == ELFCLASS32 ? 32 : 64,
+	    full ? "--full" : "default", libs, syms, wall, libs / wall, syms / wall, peak);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void usage(const char *program_name) {
+
+    printf("Usage: %s [option(s)] <symdep> [-- <symdep option(s)>]\n", program_name);
+    printf(" Generates synthetic ROM tree and measures symdep on it.\n");
+    printf(" The options are:\n");
+    printf(" -c <32|64|both>	ELF class of generated objects, default is both\n");
+    printf(" -d <n>			Levels of needed libs below target, default is %u\n", g_levels);
+    printf(" -l <n>			Libs per level, default is %u\n", g_libs);
+    printf(" -n <n>			DT_NEEDED entries per lib, default is %u\n", g_needed);
+    printf(" -i <n>			Imports per lib, default is %u\n", g_imports);
+    printf(" -e <n>			Exports per lib, default is %u\n", g_exports);
+    printf(" -m <n>			Percent of imports which are missing, default is %u\n", g_missing);
+    printf(" -H <gnu|sysv|none>	Hash table of generated objects, default is gnu\n");
+    printf(" -r <n>			Runs per measurement, median is reported, default is %u\n", g_runs);
+    printf(" -o <dir>		Generate tree in <dir> and keep it\n");
+    printf(" -h			Display this information\n");
+}
+
+int main(int argc, char **argv) {
+
+    int i, extra_cnt = 0, ret;
+    uint8_t classes[2], class_cnt = 0, keep = 0, k;
+    char root[PATH_MAX] = "/tmp/symbench.XXXXXX", *symdep = NULL, **extra = NULL, *cls = "both";
+    size_t libs = 0, syms = 0, full_libs = 0, full_syms = 0;
+
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "--")) {
+	    extra = argv + i + 1;
+	    extra_cnt = argc - i - 1;
+	    break;
+	}
+	else if (!strcmp(argv[i], "-h")) {
+	    usage(argv[0]);
+	    return 0;
+	}
+	else if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0') {
+	    if (i + 1 == argc) {
+		printf("Missing value for argument \"%s\"\n", argv[i]);
+		return EINVAL;
+	    }
+	    switch (argv[i][1]) {
+	    case 'c': cls = argv[++i]; break;
+	    case 'd': g_levels = atoi(argv[++i]); break;
+	    case 'l': g_libs = atoi(argv[++i]); break;
+	    case 'n': g_needed = atoi(argv[++i]); break;
+	    case 'i': g_imports = atoi(argv[++i]); break;
+	    case 'e': g_exports = atoi(argv[++i]); break;
+	    case 'm': g_missing = atoi(argv[++i]); break;
+	    case 'r': g_runs = atoi(argv[++i]); break;
+	    case 'o': snprintf(root, PATH_MAX, "%s", argv[++i]); keep = 1; break;
+	    case 'H':
+		i++;
+		if (!strcmp(argv[i], "gnu"))
+		    g_hash = HASH_GNU;
+		else if (!strcmp(argv[i], "sysv"))
+		    g_hash = HASH_SYSV;
+		else if (!strcmp(argv[i], "none"))
+		    g_hash = HASH_NONE;
+		else {
+		    printf("Invalid value for argument \"-H\"\n");
+		    return EINVAL;
+		}
+		break;
+	    default:
+		usage(argv[0]);
+		return EINVAL;
+	    }
+	}
+	else
+	    symdep = argv[i];
+    }
+
+    if (symdep == NULL || g_levels == 0 || g_libs == 0 || g_runs == 0) {
+	usage(argv[0]);
+	return EINVAL;
+    }
+
+    if (!strcmp(cls, "32") || !strcmp(cls, "both"))
+	classes[class_cnt++] = ELFCLASS32;
+    if (!strcmp(cls, "64") || !strcmp(cls, "both"))
+	classes[class_cnt++] = ELFCLASS64;
+    if (class_cnt == 0) {
+	printf("Invalid value for argument \"-c\"\n");
+	return EINVAL;
+    }
+
+    if (keep)
+	ret = mkdir(root, 0755) < 0 && errno != EEXIST ? -errno : 0;
+    else
+	ret = mkdtemp(root) == NULL ? -errno : 0;
+    if (ret < 0) {
+	printf("%s: %s\n", root, strerror(-ret));
+	return -ret;
+    }
+
+    printf("%u levels x %u libs, %u needed, %u imports, %u exports per lib\n",
+	    g_levels, g_libs, g_needed, g_imports, g_exports);
+    printf("%-6s %-8s %8s %10s %10s %12s %12s %10s\n",
+	    "class", "mode", "libs", "symbols", "wall, s", "libs/s", "symbols/s", "RSS, KiB");
+
+    for (k = 0; k < class_cnt; k++) {
+	ret = generate(root, classes[k], &libs, &syms, &full_libs, &full_syms);
+	if (ret < 0) {
+	    printf("%s: %s\n", root, strerror(-ret));
+	    break;
+	}
+	bench(symdep, root, classes[k], 0, libs, syms, extra, extra_cnt);
+	bench(symdep, root, classes[k], 1, full_libs, full_syms, extra, extra_cnt);
+    }
+
+    if (!keep)
+	nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    return ret < 0 ? -ret : 0;
+}
@@ -23,13 +23,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <elf.h>
 #include <libgen.h>
 #include <limits.h>
-#include <bfd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <zlib.h>
+
+/* Itanium C++ ABI demangler of C++ runtime */
+extern char *__cxa_demangle(const char *mangled_name, char *output_buffer, size_t *length, int *status);
 
 #define ARRAY_SIZE(x)	(sizeof(x)/sizeof(x[0]))
 
@@ -37,765 +52,6212 @@
 #define GREEN	"\x1b[1;32m"
 #define RESET	"\x1B[0m"
 
-struct Elf_Ehdr {
-    Elf32_Ehdr Ehdr32;
-    Elf64_Ehdr Ehdr64;
-};
-
-struct Elf_Shdr {
-    Elf32_Shdr Shdr32;
-    Elf64_Shdr Shdr64;
+#define TARGET_OK	0
+#define TARGET_STATIC	1
+#define TARGET_INVALID	2
+
+#define CACHE_MAGIC		"SYMDEPX1"
+#define CACHE_MAGIC_SIZE	8
+#define SYMDB_MAGIC		"SYMDEPD2"
+/* Second bit of export Bloom filter is taken from high bits of hash */
+#define BLOOM_SHIFT		26
+
+/* Virtual file layer */
+#define VOL_EXT4		0
+#define VOL_ZIP			1
+#define SPARSE_MAGIC		0xed26ff3a
+#define SPARSE_RAW		0xcac1
+#define SPARSE_FILL		0xcac2
+#define EXT4_MAGIC		0xef53
+#define EXT4_EXTENTS_FL		0x80000
+#define EXT4_INLINE_DATA_FL	0x10000000
+#define ZIP_BUF_SIZE		(64 * 1024)
+
+#define ARENA_CHUNK_SIZE	(64 * 1024)
+
+/* Larger note segment is not probed for build-id */
+#define NOTE_SIZE_MAX		(64 * 1024)
+/* Larger dynamic section is not read ahead */
+#define READAHEAD_DYN_MAX	(64 * 1024)
+
+/* Providers of missing symbol shown by --suggest */
+#define SUGGEST_MAX	8
+
+/* Name is not a lib in g_liblist */
+#define NO_LIB		UINT32_MAX
+
+/* Steps of lib on work stack */
+#define LIB_VISIT	0
+#define LIB_SHIM	1
+#define LIB_NEEDED	2
+#define LIB_DONE	3
+
+/* Phases of --stats report */
+#define PHASE_PREFETCH	0
+#define PHASE_PROBE	1
+#define PHASE_MAP	2
+#define PHASE_PARSE	3
+#define PHASE_IMPORTS	4
+#define PHASE_RESOLVE	5
+#define PHASE_CNT	6
+
+/* Counters are shared with prefetch workers */
+#define STAT_ADD(counter, n)	do { if (g_stats) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED); } while (0)
+
+/* Views into the memory-mapped ELF image.
+ * Tables are never copied, pointers reference the mapping directly
+ */
+union Elf_Ehdr {
+    const void *raw;
+    const Elf32_Ehdr *Ehdr32;
+    const Elf64_Ehdr *Ehdr64;
 };
 
-struct Elf_Sym {
-    Elf32_Sym Sym32;
-    Elf64_Sym Sym64;
+union Elf_Phdr {
+    const void *raw;
+    const Elf32_Phdr *Phdr32;
+    const Elf64_Phdr *Phdr64;
 };
 
-struct Elf_Dyn {
-    Elf32_Dyn Dyn32;
-    Elf64_Dyn Dyn64;
+union Elf_Shdr {
+    const void *raw;
+    const Elf32_Shdr *Shdr32;
+    const Elf64_Shdr *Shdr64;
 };
 
-struct lib_list {
-    uint16_t parent_id;
-    unsigned char *name;
-    struct lib_list *next;
+union Elf_Sym {
+    const void *raw;
+    const Elf32_Sym *Sym32;
+    const Elf64_Sym *Sym64;
 };
 
-struct sym_list {
-    uint8_t found;
-    uint16_t lib_id;
-    unsigned char *symbol;
-    struct sym_list *next;
+union Elf_Dyn {
+    const void *raw;
+    const Elf32_Dyn *Dyn32;
+    const Elf64_Dyn *Dyn64;
 };
 
-struct shim_libs {
-    unsigned char lib[NAME_MAX];
-    unsigned char shim[NAME_MAX];
-    uint8_t processed;
+struct Elf_Str {
+    const unsigned char *data;
+    size_t size;
 };
 
-static uint8_t g_elf_class, g_cur_depth = 0, g_depth = 1, g_silent = 0, g_full = 0,
-	g_path_cnt = 0, g_cust_path = 0, g_verbose = 0, g_shim_cnt = 0;
-static struct sym_list *g_symlist = NULL;
-static struct lib_list *g_liblist = NULL;
-static struct shim_libs g_shimlibs[32];
-static unsigned char g_padding[129];
-static unsigned char g_paths[16][PATH_MAX];
-
-static int read_header(int fd, struct Elf_Ehdr *elf_header) {
-    int ret;
+struct elf_image {
+    const unsigned char *base;
     size_t size;
+    struct timespec mtime;
+    /* Mapping which holds the image or NULL if image is read into memory */
+    void *map;
+    size_t map_size;
+};
 
-    if (lseek(fd, 0, SEEK_SET) < 0)
-	return -errno;
+/* Chunk of Android sparse image */
+struct sparse_chunk {
+    uint64_t block;
+    uint32_t blocks;
+    uint16_t type;
+    uint32_t fill;
+    /* Offset of chunk data in underlying file */
+    uint64_t offset;
+};
 
-    if (g_elf_class == ELFCLASS32) {
-	size = sizeof(Elf32_Ehdr);
-	ret = read(fd, &elf_header->Ehdr32, size);
-    }
-    else {
-	size = sizeof(Elf64_Ehdr);
-	ret = read(fd, &elf_header->Ehdr64, size);
-    }
+/* File blocks which are contiguous in ext4 image */
+struct extent_run {
+    uint64_t block;
+    uint64_t start;
+    uint32_t len;
+    uint8_t uninit;
+};
 
-    if (ret != size)
-        return -EIO;
+struct zip_entry {
+    unsigned char *name;
+    uint64_t offset, csize, size;
+    uint16_t method;
+};
 
-    return 0;
-}
+/* File or directory inside volume */
+struct vnode {
+    struct volume *vol;
+    /* Inode of ext4 or index of zip entry */
+    uint64_t id;
+    mode_t mode;
+    uint64_t size;
+    uint32_t flags;
+    /* i_block of ext4 inode: extent tree root, inline data or symlink */
+    unsigned char block[60];
+    struct extent_run *runs;
+    size_t run_cnt;
+    /* Zip entry data, or length of name of zip directory */
+    uint64_t data, csize;
+    uint16_t method;
+};
 
-static struct Elf_Shdr* read_section_table(int fd, const struct Elf_Ehdr *elf_header) {
+struct vdir_entry {
+    unsigned char *name;
+    uint64_t id;
+    uint8_t type;
+};
 
-    size_t i, size;
-    uint64_t offset;
-    uint16_t num;
-    int ret;
-    struct Elf_Shdr *section_table;
+/* Cached ext4 directory, entries are sorted by name */
+struct vdir {
+    uint64_t id;
+    struct vdir_entry *entries;
+    size_t cnt;
+    struct vdir *next;
+};
 
-    if (g_elf_class == ELFCLASS32) {
-	offset = elf_header->Ehdr32.e_shoff;
-	num = elf_header->Ehdr32.e_shnum;
-    }
-    else {
-	offset = elf_header->Ehdr64.e_shoff;
-	num = elf_header->Ehdr64.e_shnum;
-    }
+/* Image or archive which is entered like a directory */
+struct volume {
+    unsigned char *path;
+    size_t path_len;
+    uint8_t type;
+    /* Image file or file of outer volume */
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    struct vnode *parent;
+    struct volume *outer;
+    struct timespec mtime;
+    uint64_t size;
+    struct sparse_chunk *chunks;
+    size_t chunk_cnt;
+    uint32_t chunk_size;
+    /* ext4 */
+    uint32_t block_size, inode_size, inodes_per_group, desc_size;
+    uint64_t group_cnt;
+    unsigned char *descs;
+    struct vdir *dirs[256];
+    /* zip */
+    struct zip_entry *entries;
+    size_t entry_cnt;
+    struct volume *next;
+};
 
-    if (lseek(fd, offset, SEEK_SET) < 0)
-	return NULL;
+/* .gnu.hash or .hash table of an object */
+struct Elf_Hash {
+    uint32_t type;		/* DT_GNU_HASH, DT_HASH or DT_NULL if there is none */
+    uint32_t nbuckets;
+    uint32_t nchain;		/* DT_HASH only */
+    uint32_t symoffset;		/* DT_GNU_HASH only */
+    uint32_t bloom_size;	/* DT_GNU_HASH only */
+    uint32_t bloom_shift;	/* DT_GNU_HASH only */
+    union {
+	const void *raw;
+	const Elf32_Addr *Bloom32;
+	const Elf64_Addr *Bloom64;
+    } bloom;
+    const uint32_t *buckets;
+    const uint32_t *chain;
+};
 
-    section_table = (struct Elf_Shdr *)malloc(sizeof(struct Elf_Shdr) * num);
-    if (section_table == NULL)
-	return NULL;
+struct elf_object {
+    union Elf_Ehdr header;
+    /* Either table may be missing, sections are stripped from some blobs */
+    union Elf_Phdr program_table;
+    union Elf_Shdr section_table;
+    union Elf_Dyn dynamic_table;
+    size_t dyn_cnt;
+    union Elf_Sym symbol_table;
+    size_t sym_cnt;
+    struct Elf_Str string_table;
+    struct Elf_Hash hash;
+};
 
-    for (i = 0; i < num; i++) {
-	if (g_elf_class == ELFCLASS32) {
-	    size = sizeof(Elf32_Shdr);
-	    ret = read(fd, &section_table[i].Shdr32, size);
-	}
-	else {
-	    size = sizeof(Elf64_Shdr);
-	    ret = read(fd, &section_table[i].Shdr64, size);
-	}
-	if (ret != size)
-	    goto error;
-    }
+/* Memory of per-target lists, released at once */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size, used;
+    unsigned char data[];
+};
 
-    return section_table;
+/* Lib and symbol names are stored once per target,
+ * so they can be compared by pointer
+ */
+struct intern_name {
+    uint32_t hash;
+    /* Position in g_liblist if name is a lib in list */
+    uint32_t lib_id;
+    /* Lib was queued for readahead */
+    uint8_t readahead;
+    struct intern_name *next;
+    unsigned char str[];
+};
 
-error:
-    free(section_table);
-    return NULL;
-}
+struct lib_list {
+    uint32_t parent_id, depth;
+    const unsigned char *name;
+};
 
-static struct Elf_Dyn* read_dynamic_table(int fd, const struct Elf_Shdr *section) {
+/* Demangled symbol, kept for the whole run */
+struct demangled_name {
+    uint32_t hash;
+    struct demangled_name *next;
+    /* NULL if symbol is not a C++ name */
+    const unsigned char *demangled;
+    unsigned char symbol[];
+};
 
-    size_t size, i, n;
-    uint64_t offset;
-    struct Elf_Dyn *dynamic_table;
+/* Export of lib in search directories, keyed by whole symbol
+ * or, for C++ functions, by qualified name without parameters
+ */
+struct provider {
+    uint32_t hash, key_len;
+    uint8_t similar;
+    const unsigned char *symbol;
+    const struct lib_entry *lib;
+    struct provider *next;
+};
 
-    if (section == NULL)
-	return NULL;
+/* Export of load set in global mode, first lib in load order provides it */
+struct global_export {
+    uint32_t hash, lib_id;
+    const unsigned char *name;
+    struct global_export *next;
+};
 
-    if (g_elf_class == ELFCLASS32) {
-	size = sizeof(Elf32_Dyn);
-	n = section->Shdr32.sh_size / size;
-	offset = section->Shdr32.sh_offset;
-    }
-    else {
-	size = sizeof(Elf64_Dyn);
-	n = section->Shdr64.sh_size / size;
-	offset = section->Shdr64.sh_offset;
-    }
+/* Lib waiting on work stack for its shim and DT_NEEDED libs */
+struct lib_frame {
+    const unsigned char *name;
+    uint32_t id, parent_id, depth;
+    uint8_t state, is_shim;
+    /* Last shim of lib pushed or -1 */
+    int shim, ret;
+    /* Interned DT_NEEDED names and next one to process */
+    const unsigned char **needed;
+    size_t needed_cnt, next;
+};
 
-    if (lseek(fd, offset, SEEK_SET) < 0)
-	return NULL;
+struct sym_list {
+    uint8_t found;
+    uint32_t lib_id;
+    uint32_t hash;
+    const unsigned char *symbol;
+    struct sym_list *next;
+    /* Chain in g_symhash bucket */
+    struct sym_list *hash_next;
+    /* Next symbol required by the same lib */
+    struct sym_list *lib_next;
+};
 
-    dynamic_table = (struct Elf_Dyn *)malloc(sizeof(struct Elf_Dyn) * n);
-    if (dynamic_table == NULL)
-	return NULL;
+struct lib_syms {
+    struct sym_list *head, *tail;
+};
 
-    for (i = 0; i < n; i++)
-	if (g_elf_class == ELFCLASS32) {
-	    if (read(fd, &dynamic_table[i].Dyn32, size) != size)
-		goto error;
-	}
-	else {
-	    if (read(fd, &dynamic_table[i].Dyn64, size) != size)
-		goto error;
-	}
+/* On-disk record of export index */
+struct cache_record {
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t record_size;
+    uint32_t needed_cnt;
+    uint32_t import_cnt;
+    uint32_t export_cnt;
+    uint16_t path_len;
+    uint8_t build_id_len;
+    uint8_t elf_class;
+    uint32_t strings_size;
+    /* Followed by sorted export hashes, build-id, path and strings:
+     * needed libs, imports and exports in order of hashes
+     */
+};
 
-    return dynamic_table;
+struct cache_entry {
+    const struct cache_record *rec;
+    /* Record is allocated rather than mapped */
+    uint8_t owned;
+    /* Record was checked against the file during this run */
+    uint8_t verified;
+    /* Record is mapped from symdb, there is no file to check it against */
+    uint8_t symdb;
+    const unsigned char **strings;
+    const unsigned char **needed, **imports, **exports;
+    /* Bloom filter of export hashes, lives in the same block as strings */
+    const uint64_t *bloom;
+    uint32_t bloom_mask;
+    struct cache_entry *next;
+};
 
-error:
-    free(dynamic_table);
-    return NULL;
-}
+struct cache_export {
+    uint32_t hash;
+    const unsigned char *name;
+};
 
-static struct Elf_Sym* read_symbol_table(int fd, const struct Elf_Shdr *section) {
+/* Entry of soname table of symdb, table is sorted by ELF class,
+ * file name and search order
+ */
+struct symdb_lib {
+    uint64_t record;	/* Offset of record in symdb */
+    uint64_t name;	/* Offset of file name, which ends path of record */
+    uint8_t elf_class;
+    uint8_t pad[7];
+};
 
-    size_t size, i, n;
-    uint64_t offset;
-    struct Elf_Sym *symbol_table;
+/* Shared object of ROM being written to symdb */
+struct symdb_name {
+    const unsigned char *name;
+    struct symdb_lib lib;
+};
 
-    if (section == NULL)
-	return NULL;
+/* Shared object of system tree compared in diff mode */
+struct diff_lib {
+    const unsigned char *name;
+    const unsigned char *path;
+    size_t order;
+    const struct cache_entry *entry;
+};
 
-    if (g_elf_class == ELFCLASS32) {
-	size = sizeof(Elf32_Sym);
-	n = section->Shdr32.sh_size / size;
-	offset = section->Shdr32.sh_offset;
-    }
-    else {
-	size = sizeof(Elf64_Sym);
-	n = section->Shdr64.sh_size / size;
-	offset = section->Shdr64.sh_offset;
-    }
+/* Export which vanished from shared object of old tree */
+struct diff_export {
+    uint32_t hash;
+    uint8_t elf_class;
+    /* Whether any object of new tree still exports it, -1 if not known yet */
+    int8_t provided;
+    const unsigned char *symbol;
+    const struct diff_lib *lib;
+};
 
-    if (lseek(fd, offset, SEEK_SET) < 0)
-	return NULL;
+/* Parallel prefetch of dependency graph */
+struct prefetch_task {
+    const unsigned char *name;
+    uint32_t depth;
+    uint8_t elf_class;
+};
 
-    symbol_table = (struct Elf_Sym *)malloc(sizeof(struct Elf_Sym) * n);
-    if (symbol_table == NULL)
-	return NULL;
+struct prefetch_queue {
+    pthread_mutex_t lock;
+    struct prefetch_task *tasks;
+    size_t head, tail, size;
+};
 
+/* Lib queued for prefetch and the lowest depth it was reached at */
+struct prefetch_claim {
+    unsigned char *name;
+    uint32_t depth;
+    uint8_t elf_class;
+    struct prefetch_claim *next;
+};
 
-    for (i = 0; i < n; i++)
-	if (g_elf_class == ELFCLASS32) {
-	    if (read(fd, &symbol_table[i].Sym32, size) != size)
-		goto error;
-	}
-	else {
-	    if (read(fd, &symbol_table[i].Sym64, size) != size)
-		goto error;
-	}
+struct shim_libs {
+    unsigned char lib[NAME_MAX + 1];
+    unsigned char shim[NAME_MAX + 1];
+    uint8_t processed;
+    uint32_t hash;
+    /* Next shim in g_shim_index bucket or -1 */
+    int next;
+};
 
-    return symbol_table;
+/* Shared object of search directories */
+struct lib_entry {
+    uint32_t hash;
+    unsigned char *name;
+    unsigned char *path;
+    struct lib_entry *next;
+};
 
-error:
-    free(symbol_table);
-    return NULL;
-}
+struct stats_time {
+    struct timespec wall, cpu;
+};
 
-static unsigned char* read_string_table(int fd, const struct Elf_Shdr *section) {
+/* Cost of lib summed over all times it was processed */
+struct lib_stats {
+    unsigned char *path;
+    uint32_t hash;
+    size_t visits, imports, lookups;
+    double wall;
+    struct lib_stats *next;
+};
 
-    size_t size;
-    uint64_t offset;
-    unsigned char *string_table;
+/* Directory watched by resident daemon */
+struct watch {
+    int wd;
+    unsigned char *path;
+};
 
-    if (section == NULL)
-        return NULL;
+/* ELF class of objects being parsed, prefetch workers have their own */
+static __thread uint8_t g_elf_class;
+static unsigned int g_depth = 1;
+static uint8_t g_silent = 0, g_full = 0,
+	g_verbose = 0, g_global = 0;
+static struct sym_list *g_symlist = NULL, *g_symlist_tail = NULL;
+/* Index over g_symlist keyed by (lib_id, symbol) */
+static struct sym_list **g_symhash = NULL;
+static size_t g_symhash_size = 0, g_sym_cnt = 0;
+/* Symbols required by each lib, indexed by lib_id */
+static struct lib_syms *g_lib_syms = NULL;
+static size_t g_lib_syms_size = 0;
+/* Libs of target, indexed by lib_id */
+static struct lib_list *g_liblist = NULL;
+static size_t g_lib_cnt = 0, g_lib_size = 0;
+/* Exports merged over load set in global mode */
+static struct global_export **g_exports = NULL;
+static size_t g_exports_size = 0, g_exports_cnt = 0;
+/* Work stack of dependency graph traversal */
+static struct lib_frame *g_frames = NULL;
+static size_t g_frame_cnt = 0, g_frame_size = 0;
+static struct arena_chunk *g_arena = NULL, *g_arena_free = NULL;
+static struct intern_name **g_names = NULL;
+static size_t g_names_size = 0, g_names_cnt = 0;
+/* Shims by hash of lib name, one lib may have several shims */
+static struct shim_libs *g_shimlibs = NULL;
+static size_t g_shim_cnt = 0, g_shim_size = 0, g_shim_index_size = 0;
+static int *g_shim_index = NULL;
+/* Search directories, custom ones come first */
+static unsigned char **g_paths = NULL;
+static size_t g_path_cnt = 0, g_path_size = 0, g_cust_path = 0;
+/* Search directories listed once, by lib name for ELF32 and ELF64 */
+static struct lib_entry **g_lib_index[2] = { NULL, NULL };
+static size_t g_lib_index_size[2] = { 0, 0 }, g_lib_index_cnt[2] = { 0, 0 };
+static unsigned char *g_lib_index_key = NULL;
+/* Bumped whenever lib index is dropped */
+static size_t g_lib_index_gen = 0;
+/* Reverse index of search directories by ELF class, built for --suggest */
+static struct provider **g_providers[2] = { NULL, NULL }, *g_provider_pool[2] = { NULL, NULL };
+static struct lib_entry *g_provider_libs[2] = { NULL, NULL };
+static size_t g_providers_size[2] = { 0, 0 }, g_providers_gen[2] = { 0, 0 };
+static unsigned char *g_home;
+/* Targets to check */
+static uint8_t g_demangle = 0, g_suggest = 0, g_target_status = TARGET_OK;
+/* Symbols demangled so far and output buffer reused by demangler */
+static struct demangled_name **g_demangled = NULL;
+static size_t g_demangled_size = 0, g_demangled_cnt = 0, g_demangle_buf_size = 0;
+static char *g_demangle_buf = NULL;
+static unsigned char **g_targets = NULL;
+static size_t g_target_cnt = 0, g_target_size = 0;
+/* Root of tree checked in sweep mode */
+static unsigned char *g_sweep = NULL;
+/* Checked targets and targets with missing symbols by ELF class */
+static size_t g_checked_cnt[2] = { 0, 0 }, g_unresolved_cnt[2] = { 0, 0 };
+/* Export index */
+static uint8_t g_use_cache = 0, g_keep_cache = 0, g_cache_dirty = 0;
+/* Daemon was started with --cache */
+static uint8_t g_serve_cache = 0;
+static unsigned char g_cache_path[PATH_MAX];
+static const unsigned char *g_cache_map = NULL;
+static size_t g_cache_map_size = 0, g_cache_size = 0, g_cache_cnt = 0;
+static struct cache_entry **g_cache = NULL;
+
+static unsigned char *g_symdb = NULL, *g_make_symdb = NULL, *g_diff[2] = { NULL, NULL };
+static unsigned char g_symdb_path[PATH_MAX];
+static const unsigned char *g_symdb_map = NULL;
+static size_t g_symdb_map_size = 0, g_symdb_cnt = 0;
+static struct timespec g_symdb_mtime;
+static const struct symdb_lib *g_symdb_libs = NULL;
+/* Index is shared with prefetch workers */
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct volume *g_volumes = NULL;
+static pthread_mutex_t g_vfs_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Prefetch workers */
+static unsigned int g_jobs = 1;
+static struct prefetch_queue *g_queues = NULL;
+static unsigned int g_queue_cnt = 0;
+static struct prefetch_claim *g_claims[1024];
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_pool_cond = PTHREAD_COND_INITIALIZER;
+static size_t g_pending = 0;
+static uint64_t g_pool_gen = 0;
+/* Readahead of needed libs when there are no prefetch workers */
+static pthread_t g_readahead_thread;
+static pthread_mutex_t g_readahead_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_readahead_cond = PTHREAD_COND_INITIALIZER;
+static unsigned char **g_readahead_queue = NULL;
+static size_t g_readahead_head = 0, g_readahead_tail = 0, g_readahead_size = 0;
+static uint8_t g_readahead_on = 0, g_readahead_stop = 0;
+/* Resident daemon */
+static uint8_t g_serving = 0, g_client = 0;
+static unsigned char g_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static char *g_program;
+static int g_inotify = -1;
+static struct watch *g_watches = NULL;
+static size_t g_watch_cnt = 0, g_watch_size = 0;
+static volatile sig_atomic_t g_stop = 0;
+/* Run statistics */
+static uint8_t g_stats = 0;
+static double g_phase_wall[PHASE_CNT], g_phase_cpu[PHASE_CNT];
+static size_t g_stat_syscalls = 0, g_stat_mapped = 0, g_stat_opened = 0, g_stat_parsed = 0,
+	g_stat_reused = 0, g_stat_inserted = 0, g_stat_strcmp = 0, g_stat_bloom = 0;
+static struct lib_stats *g_lib_stats[256];
+static size_t g_lib_stats_cnt = 0;
+
+static int map_image(int fd, struct elf_image *image) {
+
+    struct stat st;
+    void *base;
+
+    if (fstat(fd, &st) < 0)
+	return -errno;
 
-    if (g_elf_class == ELFCLASS32) {
-	size = section->Shdr32.sh_size;
-	offset = section->Shdr32.sh_offset;
-    }
-    else {
-	size = section->Shdr64.sh_size;
-	offset = section->Shdr64.sh_offset;
-    }
+    if (st.st_size < EI_NIDENT)
+	return -EIO;
 
-    if (lseek(fd, offset, SEEK_SET) < 0)
-	return NULL;
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    STAT_ADD(g_stat_syscalls, 2);
+    if (base == MAP_FAILED)
+	return -errno;
+    STAT_ADD(g_stat_mapped, st.st_size);
 
-    string_table = (unsigned char *)malloc(size);
-    if (string_table == NULL)
-	return NULL;
+    image->base = base;
+    image->size = st.st_size;
+    image->mtime = st.st_mtim;
+    image->map = base;
+    image->map_size = st.st_size;
 
-    if (read(fd, string_table, size) != size)
-	goto error;
+    return 0;
+}
 
-    return string_table;
+static inline void unmap_image(struct elf_image *image) {
 
-error:
-    free(string_table);
-    return NULL;
+    if (image->map != NULL) {
+	munmap(image->map, image->map_size);
+	STAT_ADD(g_stat_syscalls, 1);
+    }
+    else
+	free((void *)image->base);
+    image->base = NULL;
+    image->size = 0;
 }
 
-static inline struct Elf_Shdr* section_by_type(const struct Elf_Ehdr *elf_header,
-		    uint32_t section_type, struct Elf_Shdr *section_table)
-{
-    size_t i;
-    uint16_t num;
+/* Returns pointer to [offset, offset + size) range of image
+ * or NULL if range doesn't fit in
+ */
+static inline const void* image_range(const struct elf_image *image, uint64_t offset, uint64_t size) {
 
-    if (section_table == NULL)
+    if (offset > image->size || size > image->size - offset)
 	return NULL;
 
-    if (g_elf_class == ELFCLASS32) {
-	num = elf_header->Ehdr32.e_shnum;
+    return image->base + offset;
+}
 
-	for (i = 0; i < num; i++) {
-	    if (section_type == section_table[i].Shdr32.sh_type)
-		return &section_table[i];
-        }
-    }
-    else {
-	num = elf_header->Ehdr64.e_shnum;
+static inline uint16_t get16(const unsigned char *p) {
 
-	for (i = 0; i < num; i++) {
-	    if (section_type == section_table[i].Shdr64.sh_type)
-		return &section_table[i];
-        }
-    }
+    uint16_t v;
 
-    return NULL;
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
-static inline struct Elf_Shdr* section_by_index(const struct Elf_Ehdr *elf_header,
-			    uint32_t index, struct Elf_Shdr *section_table)
-{
-    uint16_t num;
+static inline uint32_t get32(const unsigned char *p) {
 
-    if (section_table == NULL)
-	return NULL;
+    uint32_t v;
 
-    if (g_elf_class == ELFCLASS32)
-	num = elf_header->Ehdr32.e_shnum;
-    else
-	num = elf_header->Ehdr64.e_shnum;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
 
-    if (index >= num)
-	return NULL;
+static inline uint64_t get64(const unsigned char *p) {
 
-    return &section_table[index];
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
-static inline int add_in_lib_list(const unsigned char *libname, uint16_t parent_id) {
+static int node_read(const struct vnode *node, void *buf, size_t size, uint64_t offset);
+static int node_locate(const struct vnode *node, uint64_t offset, uint64_t size, int *fd, uint64_t *pos);
 
-    struct lib_list *val, *last_val;
-    uint16_t length, id = 0;
+/* Read underlying file of volume */
+static int vol_read_raw(const struct volume *vol, void *buf, size_t size, uint64_t offset) {
 
-    /* Find the last value in list
-     * and also check if lib is already in list
-     */
-    val = g_liblist;
-    while (val != NULL) {
-	if (!strcmp(val->name, libname))
-	    return id;
-	id++;
-	last_val = val;
-	val = val->next;
-    }
+    unsigned char *p = buf;
+    ssize_t n;
 
-    val = (struct lib_list *)malloc(sizeof(struct lib_list));
-    if (val == NULL)
-	return -1;
+    if (vol->parent != NULL)
+	return node_read(vol->parent, buf, size, offset);
 
-    length = strlen(libname);
-    val->name = (unsigned char *)malloc(length + 1);
-    if (val->name == NULL) {
-	free(val);
-	return -1;
+    while (size > 0) {
+	n = pread(vol->fd, p, size, offset);
+	STAT_ADD(g_stat_syscalls, 1);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return n < 0 ? -errno : -EIO;
+	p += n;
+	offset += n;
+	size -= n;
     }
-    memcpy(val->name, libname, length);
-    val->name[length] = '\0';
-    val->next = NULL;
-    val->parent_id = parent_id;
 
-    if (g_liblist == NULL)
-	g_liblist = val;
-    else
-	last_val->next = val;
-
-    return id;
+    return 0;
 }
 
-static inline void add_in_sym_list(const unsigned char *symbol, uint16_t lib_id) {
-
-    struct sym_list *val, *last_val;
-    size_t length;
-
-    /* Find the last value in list
-     * and also check if symbol is already in list
-     */
-    val = g_symlist;
-    while (val != NULL) {
-	if (val->lib_id == lib_id && !strcmp(val->symbol, symbol))
-	    return;
-	last_val = val;
-	val = val->next;
-    }
+static const struct sparse_chunk* sparse_chunk(const struct volume *vol, uint64_t block) {
 
-    val = (struct sym_list *)malloc(sizeof(struct sym_list));
-    if (val == NULL)
-	return;
+    size_t lo = 0, hi = vol->chunk_cnt, mid;
 
-    length = strlen(symbol);
-    val->symbol = (unsigned char *)malloc(length + 1);
-    if (val->symbol == NULL) {
-	free(val);
-	return;
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (vol->chunks[mid].block + vol->chunks[mid].blocks <= block)
+	    lo = mid + 1;
+	else
+	    hi = mid;
     }
-    memcpy(val->symbol, symbol, length);
-    val->symbol[length] = '\0';
-    val->found = 0;
-    val->lib_id = lib_id;
-    val->next = NULL;
 
-    if (g_symlist == NULL)
-	g_symlist = val;
-    else
-	last_val->next = val;
+    return lo < vol->chunk_cnt && vol->chunks[lo].block <= block ? &vol->chunks[lo] : NULL;
 }
 
-static int open_lib(const unsigned char *libname) {
+/* Read volume, sparse image is expanded on the fly */
+static int vol_read(const struct volume *vol, void *buf, size_t size, uint64_t offset) {
 
-    size_t i;
-    unsigned char *path, full_path[PATH_MAX];
+    unsigned char *p = buf;
+    const struct sparse_chunk *chunk;
+    uint64_t pos;
+    size_t i, n;
+    int ret;
 
-    for (i = 0; i < g_path_cnt; i++) {
-	path = basename(g_paths[i]);
-	/* Look for lib in provided custom directories
-	 * and appropriate to our ELF class directories
-	 */
-	if (i < g_cust_path || (!strcmp(path, "lib") && g_elf_class == ELFCLASS32)
-	    || (!strcmp(path, "lib64") && g_elf_class == ELFCLASS64))
-	{
-		sprintf(full_path, "%s/%s", g_paths[i], libname);
-		if (!access(full_path, R_OK))
-		    return open(full_path, O_RDONLY);
+    if (vol->chunks == NULL)
+	return vol_read_raw(vol, buf, size, offset);
+
+    while (size > 0) {
+	chunk = sparse_chunk(vol, offset / vol->chunk_size);
+	if (chunk == NULL)
+	    return -EIO;
+	pos = offset - chunk->block * vol->chunk_size;
+	n = (uint64_t)chunk->blocks * vol->chunk_size - pos;
+	if (n > size)
+	    n = size;
+
+	if (chunk->type == SPARSE_RAW) {
+	    if ((ret = vol_read_raw(vol, p, n, chunk->offset + pos)) < 0)
+		return ret;
 	}
+	else if (chunk->type == SPARSE_FILL)
+	    for (i = 0; i < n; i++)
+		p[i] = ((const unsigned char *)&chunk->fill)[(pos + i) % 4];
+	else
+	    memset(p, 0, n);
+
+	p += n;
+	offset += n;
+	size -= n;
     }
 
-    errno = ENOENT;
-    return -1;
+    return 0;
 }
 
-static inline int has_shim(const unsigned char *libname) {
+/* Find file and offset where range of volume is stored as is */
+static int vol_locate(const struct volume *vol, uint64_t offset, uint64_t size, int *fd, uint64_t *pos) {
 
-    size_t i;
+    const struct sparse_chunk *chunk;
 
-    for (i = 0; i < g_shim_cnt; i++)
-	if (!strcmp(libname, g_shimlibs[i].lib))
-	    return i;
+    if (vol->chunks != NULL) {
+	chunk = sparse_chunk(vol, offset / vol->chunk_size);
+	if (chunk == NULL || chunk->type != SPARSE_RAW
+	    || offset + size > (chunk->block + chunk->blocks) * vol->chunk_size)
+		return -1;
+	offset = chunk->offset + offset - chunk->block * vol->chunk_size;
+    }
 
-    return -1;
-}
+    if (vol->parent != NULL)
+	return node_locate(vol->parent, offset, size, fd, pos);
 
-static int process_lib(const unsigned char *libname, uint16_t id, uint16_t parent_id) {
+    *fd = vol->fd;
+    *pos = offset;
 
-    int i, n, fd, ret = 0;
-    uint8_t ident[EI_NIDENT];
-    struct Elf_Ehdr elf_header;
-    struct Elf_Shdr *dynamic, *dynsym, *dynstr, *section_table;
-    struct Elf_Sym *symbol_table;
-    struct Elf_Dyn *dynamic_table;
-    struct sym_list *sym_val;
-    unsigned char *string_table;
+    return 0;
+}
 
+/* Run of ext4 file which holds block or the next one */
+static const struct extent_run* node_run(const struct vnode *node, uint64_t block) {
 
+    size_t lo = 0, hi = node->run_cnt, mid;
 
-    /* Padding */
-    memset(g_padding, ' ', (g_cur_depth) * 4);
-    g_padding[(g_cur_depth) * 4] = '\0';
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (node->runs[mid].block + node->runs[mid].len <= block)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
 
-    g_cur_depth++;
+    return lo < node->run_cnt ? &node->runs[lo] : NULL;
+}
 
-    /* At the first pass, open lib explicitly.
-     * Otherwise, look for lib in directories
-     */
-    if (id == 0)
-	fd = open(libname, O_RDONLY);
-    else
-	fd = open_lib(libname);
+/* Stream deflated zip entry from its start, output before offset is dropped */
+static int zip_inflate(const struct vnode *node, unsigned char *buf, size_t size, uint64_t offset) {
 
-    if (fd < 0) {
-	ret = errno;
-	printf("%s%s: " RED "%s" RESET "\n", g_padding, libname, strerror(ret));
-	goto exit;
-    }
+    z_stream zs;
+    unsigned char *in, *skip;
+    uint64_t in_pos = 0, out_pos = 0;
+    size_t n;
+    int ret, err = 0;
 
-    if (read(fd, ident, EI_NIDENT) != EI_NIDENT) {
-	ret = errno;
-	printf("%s%s: " RED "%s" RESET "\n", g_padding, libname, strerror(ret));
-	goto exit_file;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+	return -ENOMEM;
+
+    in = (unsigned char *)malloc(2 * ZIP_BUF_SIZE);
+    if (in == NULL) {
+	inflateEnd(&zs);
+	return -ENOMEM;
     }
+    skip = in + ZIP_BUF_SIZE;
+
+    while (out_pos < offset + size) {
+	if (zs.avail_in == 0) {
+	    n = node->csize - in_pos < ZIP_BUF_SIZE ? node->csize - in_pos : ZIP_BUF_SIZE;
+	    if (n == 0 || (err = vol_read(node->vol, in, n, node->data + in_pos)) < 0)
+		break;
+	    in_pos += n;
+	    zs.next_in = in;
+	    zs.avail_in = n;
+	}
 
-    if (strncmp(ident, ELFMAG, SELFMAG) != 0) {
-	printf("%s%s: " RED "Not ELF format" RESET "\n", g_padding, libname);
-	if (id == 0)
-	    exit(EXIT_FAILURE);
+	if (out_pos < offset) {
+	    zs.next_out = skip;
+	    zs.avail_out = offset - out_pos < ZIP_BUF_SIZE ? offset - out_pos : ZIP_BUF_SIZE;
+	}
 	else {
-	    ret = EILSEQ;
-	    goto exit_file;
+	    zs.next_out = buf + (out_pos - offset);
+	    zs.avail_out = offset + size - out_pos < UINT_MAX ? offset + size - out_pos : UINT_MAX;
 	}
-    }
+	n = zs.avail_out;
 
-    if (id == 0) {
-	g_elf_class = ident[EI_CLASS];
-	if (g_elf_class != ELFCLASS32 && g_elf_class != ELFCLASS64) {
-	    printf("%s%s: " RED "Invalid ELF class" RESET "\n", g_padding, libname);
-	    exit(EXIT_FAILURE);
-	}
+	ret = inflate(&zs, Z_NO_FLUSH);
+	out_pos += n - zs.avail_out;
+	if (ret == Z_STREAM_END)
+	    break;
+	if (ret != Z_OK && ret != Z_BUF_ERROR)
+	    break;
     }
-    else
-	if (ident[EI_CLASS] != g_elf_class) {
-	    if (g_elf_class == ELFCLASS32)
-		printf("%s%s: " RED "Not ELF32 class" RESET "\n", g_padding, libname);
-	    else
-		printf("%s%s: " RED "Not ELF64 class" RESET "\n", g_padding, libname);
 
-	    ret = EINVAL;
-	    goto exit_file;
-	}
+    inflateEnd(&zs);
+    free(in);
 
-    if (ident[EI_DATA] != ELFDATA2LSB) {
-	printf("%s%s: " RED "not little endian data" RESET "\n", g_padding, libname);
-	ret = EINVAL;
-	goto exit_file;
-    }
+    if (err < 0)
+	return err;
 
+    return out_pos >= offset + size ? 0 : -EIO;
+}
 
-    ret = read_header(fd, &elf_header);
-    if (ret < 0) {
-	printf("%s%s: " RED "Error occured while reading ELF header: %s" RESET "\n", g_padding, libname, strerror(-ret));
-	goto exit_file;
-    }
+/* Read file of volume */
+static int node_read(const struct vnode *node, void *buf, size_t size, uint64_t offset) {
+
+    unsigned char *p = buf;
+    const struct extent_run *run;
+    uint64_t block, end, n;
+    uint32_t bs = node->vol->block_size;
+    int ret;
+
+    if (offset + size > node->size)
+	return -EIO;
 
-    section_table = read_section_table(fd, &elf_header);
-    if (section_table == NULL) {
-	printf("%s%s: " RED "Error occured while reading section table" RESET "\n", g_padding, libname);
-	ret = EFAULT;
-	goto exit_file;
+    if (node->vol->type == VOL_ZIP) {
+	if (node->method == 0)
+	    return vol_read(node->vol, buf, size, node->data + offset);
+	if (node->method == Z_DEFLATED)
+	    return zip_inflate(node, buf, size, offset);
+	return -ENOTSUP;
     }
 
-    dynamic = section_by_type(&elf_header, SHT_DYNAMIC, section_table);
-    if (dynamic == NULL) {
-	if (id == 0 && ((g_elf_class == ELFCLASS32 && elf_header.Ehdr32.e_type != ET_DYN)
-		     || (g_elf_class == ELFCLASS64 && elf_header.Ehdr64.e_type != ET_DYN))) {
-	printf("%s: " GREEN "Statically linked" RESET "\n", libname);
-	exit(EXIT_SUCCESS);
+    if (node->flags & EXT4_INLINE_DATA_FL) {
+	if (offset + size > sizeof(node->block))
+	    return -ENOTSUP;
+	memcpy(buf, node->block + offset, size);
+	return 0;
     }
+
+    while (size > 0) {
+	block = offset / bs;
+	run = node_run(node, block);
+	/* Holes and preallocated blocks read as zeros */
+	if (run == NULL || run->block > block || run->uninit) {
+	    end = run == NULL ? offset + size : (run->block > block ? run->block : run->block + run->len) * bs;
+	    n = end - offset < size ? end - offset : size;
+	    memset(p, 0, n);
+	}
 	else {
-	    printf("%s%s: " RED "Error occured while reading .dynamic section header" RESET "\n", g_padding, libname);
-	    ret = EFAULT;
-	    goto exit_section;
+	    n = (run->block + run->len) * bs - offset;
+	    if (n > size)
+		n = size;
+	    if ((ret = vol_read(node->vol, p, n, (run->start + block - run->block) * bs + offset % bs)) < 0)
+		return ret;
 	}
+	p += n;
+	offset += n;
+	size -= n;
     }
 
-    dynamic_table = read_dynamic_table(fd, dynamic);
-    if (dynamic_table == NULL) {
-	printf("%s%s " RED "Error occured while reading table for section .dynamic" RESET "\n", g_padding, libname);
-	ret = EFAULT;
-	goto exit_section;
-    }
+    return 0;
+}
 
-    dynsym = section_by_type(&elf_header, SHT_DYNSYM, section_table);
-    if (dynsym == NULL) {
-	printf("%s%s: " RED "Error occured while reading .dynsym section header" RESET "\n", g_padding, libname);
-	ret = EFAULT;
-	goto exit_dynamic;
+/* Find file and offset where range of file of volume is stored as is */
+static int node_locate(const struct vnode *node, uint64_t offset, uint64_t size, int *fd, uint64_t *pos) {
+
+    const struct extent_run *run;
+    uint32_t bs = node->vol->block_size;
+
+    if (node->vol->type == VOL_ZIP)
+	return node->method == 0 ? vol_locate(node->vol, node->data + offset, size, fd, pos) : -1;
+
+    if (node->flags & EXT4_INLINE_DATA_FL)
+	return -1;
+
+    run = node_run(node, offset / bs);
+    if (run == NULL || run->block > offset / bs || run->uninit || offset + size > (run->block + run->len) * bs)
+	return -1;
+
+    return vol_locate(node->vol, run->start * bs + offset - run->block * bs, size, fd, pos);
+}
+
+static void node_free(struct vnode *node) {
+
+    free(node->runs);
+    node->runs = NULL;
+    node->run_cnt = 0;
+}
+
+static int add_run(struct vnode *node, uint64_t block, uint64_t start, uint32_t len, uint8_t uninit) {
+
+    struct extent_run *runs, *last = node->run_cnt ? &node->runs[node->run_cnt - 1] : NULL;
+
+    /* Merge runs which follow each other */
+    if (last != NULL && last->uninit == uninit && last->block + last->len == block
+	&& last->start + last->len == start && last->len + len > last->len) {
+	    last->len += len;
+	    return 0;
+    }
+
+    if ((node->run_cnt & (node->run_cnt - 1)) == 0) {
+	runs = (struct extent_run *)realloc(node->runs, (node->run_cnt ? node->run_cnt * 2 : 4) * sizeof(struct extent_run));
+	if (runs == NULL)
+	    return -ENOMEM;
+	node->runs = runs;
+    }
+
+    node->runs[node->run_cnt].block = block;
+    node->runs[node->run_cnt].start = start;
+    node->runs[node->run_cnt].len = len;
+    node->runs[node->run_cnt].uninit = uninit;
+    node->run_cnt++;
+
+    return 0;
+}
+
+/* Collect leaves of extent tree in logical order */
+static int ext4_extents(struct vnode *node, const unsigned char *header, size_t size, int level) {
+
+    uint16_t i, cnt, depth;
+    uint32_t len;
+    const unsigned char *e;
+    unsigned char *block;
+    uint32_t bs = node->vol->block_size;
+    int ret;
+
+    if (size < 12 || get16(header) != 0xf30a || level > 5)
+	return -EIO;
+    cnt = get16(header + 2);
+    depth = get16(header + 6);
+    if (12 + (size_t)cnt * 12 > size)
+	return -EIO;
+
+    for (i = 0; i < cnt; i++) {
+	e = header + 12 + i * 12;
+	if (depth == 0) {
+	    len = get16(e + 4);
+	    ret = add_run(node, get32(e), (uint64_t)get16(e + 6) << 32 | get32(e + 8),
+			len > 32768 ? len - 32768 : len, len > 32768);
+	}
+	else {
+	    block = (unsigned char *)malloc(bs);
+	    if (block == NULL)
+		return -ENOMEM;
+	    ret = vol_read(node->vol, block, bs, ((uint64_t)get16(e + 8) << 32 | get32(e + 4)) * bs);
+	    if (ret == 0)
+		ret = ext4_extents(node, block, bs, level + 1);
+	    free(block);
+	}
+	if (ret < 0)
+	    return ret;
+    }
+
+    return 0;
+}
+
+static int ext4_node(struct volume *vol, uint64_t ino, struct vnode *node) {
+
+    unsigned char inode[256];
+    const unsigned char *desc;
+    uint64_t group, table;
+    size_t size = vol->inode_size < sizeof(inode) ? vol->inode_size : sizeof(inode);
+    int ret;
+
+    memset(node, 0, sizeof(struct vnode));
+    node->vol = vol;
+    node->id = ino;
+
+    group = (ino - 1) / vol->inodes_per_group;
+    if (ino == 0 || group >= vol->group_cnt)
+	return -EIO;
+    desc = vol->descs + group * vol->desc_size;
+    table = get32(desc + 8) | (vol->desc_size >= 64 ? (uint64_t)get32(desc + 0x28) << 32 : 0);
+
+    ret = vol_read(vol, inode, size, table * vol->block_size + (ino - 1) % vol->inodes_per_group * vol->inode_size);
+    if (ret < 0)
+	return ret;
+
+    node->mode = get16(inode);
+    node->size = get32(inode + 4) | (uint64_t)get32(inode + 108) << 32;
+    node->flags = get32(inode + 32);
+    memcpy(node->block, inode + 40, sizeof(node->block));
+
+    if (node->flags & EXT4_INLINE_DATA_FL)
+	return node->size <= sizeof(node->block) ? 0 : -ENOTSUP;
+    /* Fast symlink keeps target in i_block */
+    if (S_ISLNK(node->mode) && node->size < sizeof(node->block) && !(node->flags & EXT4_EXTENTS_FL))
+	return 0;
+    if (!(node->flags & EXT4_EXTENTS_FL))
+	return node->size ? -ENOTSUP : 0;
+
+    ret = ext4_extents(node, node->block, sizeof(node->block), 0);
+    if (ret < 0)
+	node_free(node);
+
+    return ret;
+}
+
+static int cmp_vdir_entry(const void *a, const void *b) {
+
+    return strcmp(((const struct vdir_entry *)a)->name, ((const struct vdir_entry *)b)->name);
+}
+
+/* Directory of ext4 volume, read once and kept sorted */
+static const struct vdir* ext4_dir(struct volume *vol, const struct vnode *node) {
+
+    struct vdir *dir;
+    struct vdir_entry *entries;
+    unsigned char *buf;
+    uint64_t p;
+    uint32_t ino;
+    uint16_t rec_len;
+    uint8_t name_len;
+    size_t i = node->id % ARRAY_SIZE(vol->dirs), size = 0;
+
+    for (dir = vol->dirs[i]; dir != NULL; dir = dir->next)
+	if (dir->id == node->id)
+	    return dir;
+
+    dir = (struct vdir *)calloc(1, sizeof(struct vdir));
+    buf = (unsigned char *)malloc(node->size + 1);
+    if (dir == NULL || buf == NULL || node_read(node, buf, node->size, 0) < 0) {
+	free(dir);
+	free(buf);
+	return NULL;
+    }
+
+    for (p = 0; p + 8 <= node->size; p += rec_len) {
+	ino = get32(buf + p);
+	rec_len = get16(buf + p + 4);
+	name_len = buf[p + 6];
+	if (rec_len < 8 || p + rec_len > node->size)
+	    break;
+	if (ino == 0 || name_len == 0 || 8 + name_len > rec_len)
+	    continue;
+
+	if (dir->cnt == size) {
+	    size = size ? size * 2 : 16;
+	    entries = (struct vdir_entry *)realloc(dir->entries, size * sizeof(struct vdir_entry));
+	    if (entries == NULL)
+		break;
+	    dir->entries = entries;
+	}
+	dir->entries[dir->cnt].name = strndup(buf + p + 8, name_len);
+	if (dir->entries[dir->cnt].name == NULL)
+	    break;
+	dir->entries[dir->cnt].id = ino;
+	dir->entries[dir->cnt].type = buf[p + 7] == 1 ? DT_REG : buf[p + 7] == 2 ? DT_DIR
+			: buf[p + 7] == 7 ? DT_LNK : DT_UNKNOWN;
+	dir->cnt++;
+    }
+    free(buf);
+
+    qsort(dir->entries, dir->cnt, sizeof(struct vdir_entry), cmp_vdir_entry);
+    dir->id = node->id;
+    dir->next = vol->dirs[i];
+    vol->dirs[i] = dir;
+
+    return dir;
+}
+
+/* First zip entry which isn't less than name */
+static size_t zip_lower_bound(const struct volume *vol, const unsigned char *name, size_t len) {
+
+    size_t lo = 0, hi = vol->entry_cnt, mid;
+
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (strncmp(vol->entries[mid].name, name, len) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+static int zip_node(struct volume *vol, size_t index, struct vnode *node) {
+
+    unsigned char header[30];
+    const struct zip_entry *entry = &vol->entries[index];
+    int ret;
+
+    memset(node, 0, sizeof(struct vnode));
+    node->vol = vol;
+    node->id = index;
+    node->mode = S_IFREG | 0644;
+    node->size = entry->size;
+    node->csize = entry->csize;
+    node->method = entry->method;
+
+    /* Data follows local header */
+    if ((ret = vol_read(vol, header, sizeof(header), entry->offset)) < 0)
+	return ret;
+    if (get32(header) != 0x04034b50)
+	return -EIO;
+    node->data = entry->offset + sizeof(header) + get16(header + 26) + get16(header + 28);
+
+    return 0;
+}
+
+/* First zip entry of directory or entry_cnt if there is no such directory */
+static size_t zip_dir(const struct volume *vol, const unsigned char *name, size_t len) {
+
+    unsigned char prefix[PATH_MAX];
+    size_t i;
+
+    if (len == 0)
+	return 0;
+    if (len + 1 >= PATH_MAX)
+	return vol->entry_cnt;
+
+    memcpy(prefix, name, len);
+    prefix[len] = '/';
+    i = zip_lower_bound(vol, prefix, len + 1);
+
+    return i < vol->entry_cnt && !strncmp(vol->entries[i].name, prefix, len + 1) ? i : vol->entry_cnt;
+}
+
+/* Resolve path inside zip, directories are implied by names of entries */
+static int zip_walk(struct volume *vol, const unsigned char *path, struct vnode *node,
+	    const unsigned char **rest, unsigned char *walked)
+{
+    size_t i, len;
+
+    while (*path == '/')
+	path++;
+
+    for (len = 0; ; len++) {
+	if (path[len] != '/' && path[len] != '\0')
+	    continue;
+	i = zip_lower_bound(vol, path, len);
+	/* Entry is a file, so the rest of path is inside of it */
+	if (len > 0 && i < vol->entry_cnt && !strncmp(vol->entries[i].name, path, len)
+	    && vol->entries[i].name[len] == '\0') {
+		snprintf(walked, PATH_MAX, "%.*s", (int)len, path);
+		*rest = path[len] != '\0' ? path + len : NULL;
+		return zip_node(vol, i, node);
+	}
+	if (path[len] == '\0')
+	    break;
+    }
+
+    /* Directory is the range of entries with its prefix */
+    while (len > 0 && path[len - 1] == '/')
+	len--;
+    i = zip_dir(vol, path, len);
+    if (len > 0 && i == vol->entry_cnt)
+	return -ENOENT;
+
+    memset(node, 0, sizeof(struct vnode));
+    node->vol = vol;
+    node->id = i;
+    node->data = len;
+    node->mode = S_IFDIR | 0755;
+    snprintf(walked, PATH_MAX, "%.*s", (int)len, path);
+    *rest = NULL;
+
+    return 0;
+}
+
+/* Resolve path inside ext4 following symlinks, stops at regular file
+ * if path goes on and points to the rest of path then
+ */
+static int ext4_walk(struct volume *vol, const unsigned char *path, struct vnode *node,
+	    const unsigned char **rest, unsigned char *walked)
+{
+    const struct vdir *dir;
+    struct vdir_entry key, *entry;
+    struct vnode next;
+    unsigned char name[NAME_MAX + 1], buf[2][PATH_MAX], target[PATH_MAX];
+    const unsigned char *p = path;
+    size_t len, walked_len = 0;
+    int ret, links = 0, cur = 0;
+
+    walked[0] = '\0';
+    if ((ret = ext4_node(vol, 2, node)) < 0)
+	return ret;
+
+    for (;;) {
+	while (*p == '/')
+	    p++;
+	*rest = NULL;
+	if (*p == '\0')
+	    return 0;
+
+	if (S_ISREG(node->mode)) {
+	    *rest = p;
+	    return 0;
+	}
+	if (!S_ISDIR(node->mode)) {
+	    node_free(node);
+	    return -ENOTDIR;
+	}
+
+	len = strcspn(p, "/");
+	if (len > NAME_MAX) {
+	    node_free(node);
+	    return -ENAMETOOLONG;
+	}
+	memcpy(name, p, len);
+	name[len] = '\0';
+	p += len;
+
+	key.name = name;
+	dir = ext4_dir(vol, node);
+	entry = dir != NULL ? bsearch(&key, dir->entries, dir->cnt, sizeof(struct vdir_entry), cmp_vdir_entry) : NULL;
+	if (entry == NULL) {
+	    node_free(node);
+	    return dir != NULL ? -ENOENT : -EIO;
+	}
+	if ((ret = ext4_node(vol, entry->id, &next)) < 0) {
+	    node_free(node);
+	    return ret;
+	}
+
+	if (S_ISLNK(next.mode)) {
+	    if (++links > 40 || next.size >= PATH_MAX) {
+		node_free(&next);
+		node_free(node);
+		return -ELOOP;
+	    }
+	    if (next.size < sizeof(next.block) && !(next.flags & EXT4_EXTENTS_FL))
+		memcpy(target, next.block, next.size);
+	    else if ((ret = node_read(&next, target, next.size, 0)) < 0) {
+		node_free(&next);
+		node_free(node);
+		return ret;
+	    }
+	    target[next.size] = '\0';
+	    node_free(&next);
+
+	    /* Splice target into the rest of path */
+	    cur ^= 1;
+	    if (snprintf(buf[cur], PATH_MAX, "%s/%s", target, p) >= PATH_MAX) {
+		node_free(node);
+		return -ENAMETOOLONG;
+	    }
+	    p = buf[cur];
+	    if (target[0] == '/') {
+		node_free(node);
+		walked_len = 0;
+		if ((ret = ext4_node(vol, 2, node)) < 0)
+		    return ret;
+	    }
+	}
+	else {
+	    node_free(node);
+	    *node = next;
+	    /* Resolved path of node */
+	    if (!strcmp(name, ".."))
+		while (walked_len > 0 && walked[--walked_len] != '/')
+		    ;
+	    else if (strcmp(name, ".") && walked_len + len + 2 < PATH_MAX)
+		walked_len += sprintf(walked + walked_len, "%s%s", walked_len ? "/" : "", name);
+	}
+	walked[walked_len] = '\0';
+    }
+}
+
+static int sparse_mount(struct volume *vol) {
+
+    unsigned char header[28], chunk[12];
+    uint32_t i, cnt;
+    uint16_t header_size, chunk_header_size;
+    uint64_t offset, block = 0;
+    struct sparse_chunk *chunks;
+    int ret;
+
+    if ((ret = vol_read_raw(vol, header, sizeof(header), 0)) < 0)
+	return ret;
+
+    header_size = get16(header + 8);
+    chunk_header_size = get16(header + 10);
+    vol->chunk_size = get32(header + 12);
+    cnt = get32(header + 20);
+    if (get16(header + 4) != 1 || header_size < sizeof(header) || chunk_header_size < sizeof(chunk)
+	|| vol->chunk_size == 0 || vol->chunk_size % 4 || cnt > (1 << 24))
+	    return -EINVAL;
+
+    chunks = (struct sparse_chunk *)malloc((cnt + 1) * sizeof(struct sparse_chunk));
+    if (chunks == NULL)
+	return -ENOMEM;
+    vol->chunks = chunks;
+
+    for (i = 0, offset = header_size; i < cnt; i++) {
+	if ((ret = vol_read_raw(vol, chunk, sizeof(chunk), offset)) < 0)
+	    return ret;
+	if (get32(chunk + 8) < chunk_header_size)
+	    return -EINVAL;
+	/* Checksum chunks hold no blocks */
+	if (get32(chunk + 4) != 0) {
+	    chunks[vol->chunk_cnt].block = block;
+	    chunks[vol->chunk_cnt].blocks = get32(chunk + 4);
+	    chunks[vol->chunk_cnt].type = get16(chunk);
+	    chunks[vol->chunk_cnt].offset = offset + chunk_header_size;
+	    chunks[vol->chunk_cnt].fill = 0;
+	    if (get16(chunk) == SPARSE_FILL
+		&& (ret = vol_read_raw(vol, &chunks[vol->chunk_cnt].fill, 4, offset + chunk_header_size)) < 0)
+		    return ret;
+	    block += get32(chunk + 4);
+	    vol->chunk_cnt++;
+	}
+	offset += get32(chunk + 8);
+    }
+    vol->size = block * vol->chunk_size;
+
+    return 0;
+}
+
+static int ext4_mount(struct volume *vol) {
+
+    unsigned char sb[1024];
+    uint32_t incompat, blocks_per_group, first_block;
+    uint64_t blocks;
+    int ret;
+
+    if (vol->size < 2048)
+	return -ENOTDIR;
+    if ((ret = vol_read(vol, sb, sizeof(sb), 1024)) < 0)
+	return ret;
+    if (get16(sb + 56) != EXT4_MAGIC)
+	return -ENOTDIR;
+
+    incompat = get32(sb + 96);
+    first_block = get32(sb + 20);
+    blocks_per_group = get32(sb + 32);
+    blocks = get32(sb + 4) | (incompat & 0x80 ? (uint64_t)get32(sb + 0x150) << 32 : 0);
+    vol->block_size = get32(sb + 24) < 7 ? 1024 << get32(sb + 24) : 0;
+    vol->inodes_per_group = get32(sb + 40);
+    vol->inode_size = get32(sb + 76) ? get16(sb + 88) : 128;
+    vol->desc_size = incompat & 0x80 ? get16(sb + 254) : 32;
+    if (vol->desc_size < 32)
+	vol->desc_size = 32;
+    if (vol->block_size == 0 || blocks_per_group == 0 || vol->inodes_per_group == 0
+	|| vol->inode_size < 128 || vol->inode_size > vol->block_size || blocks <= first_block)
+	    return -EINVAL;
+
+    vol->group_cnt = (blocks - first_block + blocks_per_group - 1) / blocks_per_group;
+    if (vol->group_cnt > (1 << 24))
+	return -EINVAL;
+    vol->descs = (unsigned char *)malloc(vol->group_cnt * vol->desc_size);
+    if (vol->descs == NULL)
+	return -ENOMEM;
+
+    return vol_read(vol, vol->descs, vol->group_cnt * vol->desc_size, (uint64_t)(first_block + 1) * vol->block_size);
+}
+
+static int cmp_zip_entry(const void *a, const void *b) {
+
+    return strcmp(((const struct zip_entry *)a)->name, ((const struct zip_entry *)b)->name);
+}
+
+/* Read central directory of zip archive, zip64 is supported */
+static int zip_mount(struct volume *vol) {
+
+    unsigned char *buf, *p, *end, *extra;
+    uint64_t cnt, dir_size, dir_offset, i;
+    size_t n = vol->size < 65557 ? vol->size : 65557;
+    struct zip_entry *entry;
+    uint16_t name_len, extra_len;
+    int ret;
+
+    buf = (unsigned char *)malloc(n);
+    if (buf == NULL)
+	return -ENOMEM;
+    if ((ret = vol_read(vol, buf, n, vol->size - n)) < 0) {
+	free(buf);
+	return ret;
+    }
+
+    /* End of central directory record is at most 64K from the end */
+    for (p = buf + n - 22; p >= buf && get32(p) != 0x06054b50; p--)
+	;
+    if (p < buf) {
+	free(buf);
+	return -ENOTDIR;
+    }
+    cnt = get16(p + 10);
+    dir_size = get32(p + 12);
+    dir_offset = get32(p + 16);
+
+    if (p - buf >= 20 && get32(p - 20) == 0x07064b50) {
+	unsigned char zip64[56];
+
+	if ((ret = vol_read(vol, zip64, sizeof(zip64), get64(p - 20 + 8))) < 0 || get32(zip64) != 0x06064b50) {
+	    free(buf);
+	    return ret < 0 ? ret : -EINVAL;
+	}
+	cnt = get64(zip64 + 32);
+	dir_size = get64(zip64 + 40);
+	dir_offset = get64(zip64 + 48);
+    }
+    free(buf);
+
+    if (dir_offset + dir_size > vol->size || dir_size > (1 << 28) || cnt > dir_size / 46)
+	return -EINVAL;
+
+    buf = (unsigned char *)malloc(dir_size);
+    vol->entries = (struct zip_entry *)calloc(cnt + 1, sizeof(struct zip_entry));
+    if (buf == NULL || vol->entries == NULL) {
+	free(buf);
+	return -ENOMEM;
+    }
+    if ((ret = vol_read(vol, buf, dir_size, dir_offset)) < 0) {
+	free(buf);
+	return ret;
+    }
+
+    end = buf + dir_size;
+    for (i = 0, p = buf; i < cnt && end - p >= 46 && get32(p) == 0x02014b50; i++) {
+	name_len = get16(p + 28);
+	extra_len = get16(p + 30);
+	if (end - p < 46 + name_len + extra_len)
+	    break;
+
+	entry = &vol->entries[vol->entry_cnt];
+	entry->method = get16(p + 10);
+	entry->csize = get32(p + 20);
+	entry->size = get32(p + 24);
+	entry->offset = get32(p + 42);
+
+	/* Sizes and offset which don't fit are in zip64 extra field */
+	for (extra = p + 46 + name_len; extra + 4 <= p + 46 + name_len + extra_len; extra += 4 + get16(extra + 2))
+	    if (get16(extra) == 1) {
+		unsigned char *field = extra + 4, *field_end = field + get16(extra + 2);
+
+		if (entry->size == UINT32_MAX && field + 8 <= field_end)
+		    entry->size = get64(field), field += 8;
+		if (entry->csize == UINT32_MAX && field + 8 <= field_end)
+		    entry->csize = get64(field), field += 8;
+		if (entry->offset == UINT32_MAX && field + 8 <= field_end)
+		    entry->offset = get64(field);
+	    }
+
+	/* Directories are implied by names of files */
+	if (name_len > 0 && p[46 + name_len - 1] != '/') {
+	    entry->name = strndup(p + 46, name_len);
+	    if (entry->name == NULL)
+		break;
+	    vol->entry_cnt++;
+	}
+	p += 46 + name_len + extra_len + get16(p + 32);
+    }
+    free(buf);
+
+    qsort(vol->entries, vol->entry_cnt, sizeof(struct zip_entry), cmp_zip_entry);
+
+    return 0;
+}
+
+static void volume_free(struct volume *vol) {
+
+    size_t i, j;
+    struct vdir *dir;
+
+    for (i = 0; i < ARRAY_SIZE(vol->dirs); i++)
+	while ((dir = vol->dirs[i]) != NULL) {
+	    vol->dirs[i] = dir->next;
+	    for (j = 0; j < dir->cnt; j++)
+		free(dir->entries[j].name);
+	    free(dir->entries);
+	    free(dir);
+	}
+
+    for (i = 0; i < vol->entry_cnt; i++)
+	free(vol->entries[i].name);
+    free(vol->entries);
+
+    if (vol->parent != NULL) {
+	node_free(vol->parent);
+	free(vol->parent);
+    }
+    else if (vol->fd >= 0)
+	close(vol->fd);
+
+    free(vol->chunks);
+    free(vol->descs);
+    free(vol->path);
+    free(vol);
+}
+
+/* Enter image file or file of outer volume as volume.
+ * Returns -ENOTDIR if file is neither ext4 image nor zip archive
+ */
+static struct volume* volume_mount(const unsigned char *path, int fd, const struct vnode *parent, int *err) {
+
+    struct volume *vol;
+    struct stat st;
+    unsigned char magic[4];
+
+    vol = (struct volume *)calloc(1, sizeof(struct volume));
+    if (vol == NULL || (vol->path = strdup(path)) == NULL) {
+	free(vol);
+	close(fd);
+	*err = -ENOMEM;
+	return NULL;
+    }
+    vol->path_len = strlen(path);
+    vol->fd = fd;
+
+    if (parent != NULL) {
+	vol->parent = (struct vnode *)malloc(sizeof(struct vnode));
+	if (vol->parent == NULL) {
+	    *err = -ENOMEM;
+	    goto error;
+	}
+	*vol->parent = *parent;
+	vol->outer = parent->vol;
+	vol->mtime = parent->vol->mtime;
+	vol->size = parent->size;
+	/* Random access into deflated stream would mean inflating it over and over */
+	if (parent->vol->type == VOL_ZIP && parent->method != 0) {
+	    *err = -ENOTSUP;
+	    goto error;
+	}
+    }
+    else {
+	if (fstat(fd, &st) < 0) {
+	    *err = -errno;
+	    goto error;
+	}
+	vol->dev = st.st_dev;
+	vol->ino = st.st_ino;
+	vol->mtime = st.st_mtim;
+	vol->size = st.st_size;
+    }
+
+    if (vol->size < sizeof(magic) || (*err = vol_read_raw(vol, magic, sizeof(magic), 0)) < 0) {
+	*err = -ENOTDIR;
+	goto error;
+    }
+
+    if (get32(magic) == 0x04034b50 || get32(magic) == 0x06054b50) {
+	vol->type = VOL_ZIP;
+	*err = zip_mount(vol);
+    }
+    else {
+	vol->type = VOL_EXT4;
+	*err = get32(magic) == SPARSE_MAGIC ? sparse_mount(vol) : 0;
+	if (*err == 0)
+	    *err = ext4_mount(vol);
+    }
+    if (*err < 0)
+	goto error;
+
+    vol->next = g_volumes;
+    g_volumes = vol;
+
+    return vol;
+
+error:
+    /* Parent node stays with its owner */
+    if (vol->parent != NULL)
+	vol->parent->runs = NULL;
+    volume_free(vol);
+    return NULL;
+}
+
+static int vol_walk(struct volume *vol, const unsigned char *path, struct vnode *node,
+	    const unsigned char **rest, unsigned char *walked)
+{
+    if (vol->type == VOL_ZIP)
+	return zip_walk(vol, path, node, rest, walked);
+
+    return ext4_walk(vol, path, node, rest, walked);
+}
+
+/* Resolve path which goes through image files */
+static int vfs_lookup(const unsigned char *path, struct vnode *node) {
+
+    struct volume *vol = NULL, *v;
+    struct stat st;
+    unsigned char prefix[PATH_MAX], walked[PATH_MAX], real[PATH_MAX];
+    const unsigned char *rest;
+    size_t len;
+    int fd, ret;
+
+    if (strlen(path) >= PATH_MAX)
+	return -ENAMETOOLONG;
+
+    pthread_mutex_lock(&g_vfs_lock);
+
+    /* The deepest volume already entered */
+    for (v = g_volumes; v != NULL; v = v->next)
+	if (!strncmp(path, v->path, v->path_len) && (path[v->path_len] == '/' || path[v->path_len] == '\0')
+	    && (vol == NULL || v->path_len > vol->path_len))
+		vol = v;
+
+    if (vol != NULL)
+	rest = path + vol->path_len;
+    else {
+	/* Look for regular file among leading components */
+	for (len = 1; ; len++) {
+	    if (path[len] != '/' && path[len] != '\0')
+		continue;
+	    memcpy(prefix, path, len);
+	    prefix[len] = '\0';
+	    if (stat(prefix, &st) < 0) {
+		ret = -errno;
+		goto exit;
+	    }
+	    STAT_ADD(g_stat_syscalls, 1);
+	    if (S_ISREG(st.st_mode))
+		break;
+	    if (path[len] == '\0') {
+		ret = -ENOENT;
+		goto exit;
+	    }
+	}
+
+	for (v = g_volumes; v != NULL; v = v->next)
+	    if (v->parent == NULL && v->dev == st.st_dev && v->ino == st.st_ino)
+		break;
+	if ((vol = v) == NULL) {
+	    fd = open(prefix, O_RDONLY);
+	    STAT_ADD(g_stat_syscalls, 1);
+	    if (fd < 0) {
+		ret = -errno;
+		goto exit;
+	    }
+	    /* Volume is known by real path, as targets and search directories are */
+	    if (realpath(prefix, real) == NULL) {
+		ret = -errno;
+		close(fd);
+		goto exit;
+	    }
+	    if ((vol = volume_mount(real, fd, NULL, &ret)) == NULL)
+		goto exit;
+	}
+	rest = path + len;
+    }
+
+    /* Enter nested images */
+    for (;;) {
+	if ((ret = vol_walk(vol, rest, node, &rest, walked)) < 0 || rest == NULL)
+	    break;
+
+	if (snprintf(prefix, PATH_MAX, "%s/%s", vol->path, walked) >= PATH_MAX) {
+	    node_free(node);
+	    ret = -ENAMETOOLONG;
+	    break;
+	}
+	for (v = g_volumes; v != NULL; v = v->next)
+	    if (v->outer == vol && !strcmp(v->path, prefix))
+		break;
+	if (v == NULL && (v = volume_mount(prefix, -1, node, &ret)) == NULL) {
+	    node_free(node);
+	    break;
+	}
+	if (v->parent->runs != node->runs)
+	    node_free(node);
+	vol = v;
+    }
+
+exit:
+    pthread_mutex_unlock(&g_vfs_lock);
+
+    return ret;
+}
+
+/* Leave all volumes */
+static void vfs_close(void) {
+
+    struct volume *vol;
+
+    while ((vol = g_volumes) != NULL) {
+	g_volumes = vol->next;
+	volume_free(vol);
+    }
+}
+
+/* Open and map ELF file. Image files and archives on the way
+ * are entered like directories, e.g. system.img/system/lib/libc.so
+ */
+static int open_image(const unsigned char *path, struct elf_image *image) {
+
+    int fd, ret;
+    uint64_t pos, delta;
+    struct vnode node;
+    void *buf;
+
+    fd = open(path, O_RDONLY);
+    STAT_ADD(g_stat_syscalls, 1);
+    if (fd >= 0) {
+	ret = map_image(fd, image);
+	close(fd);
+	STAT_ADD(g_stat_syscalls, 1);
+	return ret;
+    }
+    if (errno != ENOTDIR)
+	return -errno;
+
+    if ((ret = vfs_lookup(path, &node)) < 0)
+	return ret;
+    if (!S_ISREG(node.mode) || node.size < EI_NIDENT || node.size > SIZE_MAX) {
+	ret = S_ISDIR(node.mode) ? -EISDIR : -EIO;
+	goto exit;
+    }
+
+    image->size = node.size;
+    image->mtime = node.vol->mtime;
+
+    /* File stored as is in image file is mapped, otherwise it is read.
+     * ELF structures are accessed in place, so they must stay aligned
+     */
+    if (!node_locate(&node, 0, node.size, &fd, &pos) && pos % 8 == 0) {
+	delta = pos % sysconf(_SC_PAGESIZE);
+	buf = mmap(NULL, node.size + delta, PROT_READ, MAP_PRIVATE, fd, pos - delta);
+	STAT_ADD(g_stat_syscalls, 1);
+	if (buf != MAP_FAILED) {
+	    STAT_ADD(g_stat_mapped, node.size);
+	    image->map = buf;
+	    image->map_size = node.size + delta;
+	    image->base = (unsigned char *)buf + delta;
+	    goto exit;
+	}
+    }
+
+    buf = malloc(node.size);
+    if (buf == NULL)
+	ret = -ENOMEM;
+    else if ((ret = node_read(&node, buf, node.size, 0)) < 0)
+	free(buf);
+    else {
+	image->map = NULL;
+	image->base = buf;
+    }
+
+exit:
+    node_free(&node);
+    return ret;
+}
+
+/* Read ELF identification of file */
+static int read_ident(const unsigned char *path, unsigned char *ident) {
+
+    int fd, ret;
+    struct vnode node;
+
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+	ret = read(fd, ident, EI_NIDENT) == EI_NIDENT ? 0 : -EIO;
+	close(fd);
+	return ret;
+    }
+    if (errno != ENOTDIR)
+	return -errno;
+
+    if ((ret = vfs_lookup(path, &node)) < 0)
+	return ret;
+    ret = S_ISREG(node.mode) && node.size >= EI_NIDENT ? node_read(&node, ident, EI_NIDENT, 0) : -EIO;
+    node_free(&node);
+
+    return ret;
+}
+
+static int stat_path(const unsigned char *path, struct stat *st) {
+
+    struct vnode node;
+    int ret;
+
+    if (!stat(path, st))
+	return 0;
+    if (errno != ENOTDIR)
+	return -1;
+
+    if ((ret = vfs_lookup(path, &node)) < 0) {
+	errno = -ret;
+	return -1;
+    }
+
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = node.mode;
+    st->st_size = node.size;
+    st->st_mtim = node.vol->mtime;
+    node_free(&node);
+
+    return 0;
+}
+
+/* access() which looks into image files */
+static int access_path(const unsigned char *path, int mode) {
+
+    struct stat st;
+
+    if (!access(path, mode))
+	return 0;
+    if (errno != ENOTDIR)
+	return -1;
+
+    return stat_path(path, &st);
+}
+
+/* realpath() which looks into image files */
+static unsigned char* real_path(const unsigned char *path) {
+
+    unsigned char buf[PATH_MAX], *real = NULL, *p, *result;
+    char *save;
+    struct stat st;
+    size_t len;
+
+    if ((real = realpath(path, NULL)) != NULL || errno != ENOTDIR)
+	return real;
+
+    /* Resolve leading part which is real */
+    if (snprintf(buf, PATH_MAX, "%s", path) >= PATH_MAX) {
+	errno = ENAMETOOLONG;
+	return NULL;
+    }
+    while (real == NULL && (p = strrchr(buf, '/')) != NULL && p != buf) {
+	*p = '\0';
+	real = realpath(buf, NULL);
+    }
+    if (real == NULL)
+	return NULL;
+
+    result = (unsigned char *)malloc(PATH_MAX);
+    if (result == NULL) {
+	free(real);
+	return NULL;
+    }
+    len = snprintf(result, PATH_MAX, "%s", strcmp(real, "/") ? real : (unsigned char *)"");
+    free(real);
+
+    /* The rest is taken without "." and ".." */
+    snprintf(buf, PATH_MAX, "%s", path + strlen(buf));
+    for (p = strtok_r(buf, "/", &save); p != NULL; p = strtok_r(NULL, "/", &save)) {
+	if (!strcmp(p, "."))
+	    continue;
+	if (!strcmp(p, "..")) {
+	    while (len > 0 && result[--len] != '/')
+		;
+	    result[len] = '\0';
+	    continue;
+	}
+	if (len + strlen(p) + 2 > PATH_MAX) {
+	    free(result);
+	    errno = ENAMETOOLONG;
+	    return NULL;
+	}
+	len += sprintf(result + len, "/%s", p);
+    }
+
+    if (stat_path(result, &st) < 0) {
+	free(result);
+	return NULL;
+    }
+
+    return result;
+}
+
+/* Call fn for every entry of directory, which may be inside image file */
+static int list_dir(const unsigned char *path, int (*fn)(void *arg, const unsigned char *name, uint8_t type), void *arg) {
+
+    DIR *dir;
+    struct dirent *ent;
+    struct vnode node;
+    const struct vdir *vdir;
+    const struct volume *vol;
+    size_t i, len, child;
+    const unsigned char *name, *slash;
+    unsigned char buf[NAME_MAX + 1];
+    int ret = 0;
+
+    dir = opendir(path);
+    STAT_ADD(g_stat_syscalls, 2);
+    if (dir != NULL) {
+	while (ret >= 0 && (ent = readdir(dir)) != NULL)
+	    if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+		ret = fn(arg, ent->d_name, ent->d_type);
+	closedir(dir);
+	return ret;
+    }
+    if (errno != ENOTDIR)
+	return -errno;
+
+    if ((ret = vfs_lookup(path, &node)) < 0)
+	return ret;
+    vol = node.vol;
+    if (!S_ISDIR(node.mode)) {
+	node_free(&node);
+	return -ENOTDIR;
+    }
+
+    /* Listings are kept until volumes are left */
+    if (vol->type == VOL_EXT4) {
+	pthread_mutex_lock(&g_vfs_lock);
+	vdir = ext4_dir(node.vol, &node);
+	pthread_mutex_unlock(&g_vfs_lock);
+	node_free(&node);
+	if (vdir == NULL)
+	    return -EIO;
+	for (i = 0; i < vdir->cnt && ret >= 0; i++)
+	    if (strcmp(vdir->entries[i].name, ".") && strcmp(vdir->entries[i].name, ".."))
+		ret = fn(arg, vdir->entries[i].name, vdir->entries[i].type);
+	return ret;
+    }
+
+    /* Children of zip directory are entries with its prefix, subdirectories are reported once */
+    len = node.data;
+    child = len ? len + 1 : 0;
+    buf[0] = '\0';
+    for (i = node.id; i < vol->entry_cnt && ret >= 0; i++) {
+	name = vol->entries[i].name;
+	if (len > 0 && (strncmp(name, vol->entries[node.id].name, len) || name[len] != '/'))
+	    break;
+	slash = strchr(name + child, '/');
+	if (slash == NULL)
+	    ret = fn(arg, name + child, DT_REG);
+	else if (slash - name - child <= NAME_MAX
+	    && (strncmp(buf, name + child, slash - name - child) || buf[slash - name - child] != '\0')) {
+		snprintf(buf, sizeof(buf), "%.*s", (int)(slash - name - child), name + child);
+		ret = fn(arg, buf, DT_DIR);
+	}
+    }
+
+    return ret;
+}
+
+/* Path is the root of entered image file */
+static int is_volume(const unsigned char *path) {
+
+    const struct volume *vol;
+    int ret = 0;
+
+    pthread_mutex_lock(&g_vfs_lock);
+    for (vol = g_volumes; vol != NULL && !ret; vol = vol->next)
+	ret = !strcmp(vol->path, path);
+    pthread_mutex_unlock(&g_vfs_lock);
+
+    return ret;
+}
+
+static int read_header(const struct elf_image *image, union Elf_Ehdr *elf_header) {
+
+    if (g_elf_class == ELFCLASS32)
+	elf_header->raw = image_range(image, 0, sizeof(Elf32_Ehdr));
+    else
+	elf_header->raw = image_range(image, 0, sizeof(Elf64_Ehdr));
+
+    if (elf_header->raw == NULL)
+        return -EIO;
+
+    return 0;
+}
+
+static union Elf_Phdr read_program_table(const struct elf_image *image, const union Elf_Ehdr *elf_header) {
+
+    union Elf_Phdr program_table = { NULL };
+
+    if (g_elf_class == ELFCLASS32) {
+	if (elf_header->Ehdr32->e_phnum != 0)
+	    program_table.raw = image_range(image, elf_header->Ehdr32->e_phoff,
+			(uint64_t)sizeof(Elf32_Phdr) * elf_header->Ehdr32->e_phnum);
+    }
+    else if (elf_header->Ehdr64->e_phnum != 0)
+	program_table.raw = image_range(image, elf_header->Ehdr64->e_phoff,
+			(uint64_t)sizeof(Elf64_Phdr) * elf_header->Ehdr64->e_phnum);
+
+    return program_table;
+}
+
+static union Elf_Shdr read_section_table(const struct elf_image *image, const union Elf_Ehdr *elf_header) {
+
+    union Elf_Shdr section_table = { NULL };
+
+    if (g_elf_class == ELFCLASS32) {
+	if (elf_header->Ehdr32->e_shnum != 0)
+	    section_table.raw = image_range(image, elf_header->Ehdr32->e_shoff,
+			(uint64_t)sizeof(Elf32_Shdr) * elf_header->Ehdr32->e_shnum);
+    }
+    else if (elf_header->Ehdr64->e_shnum != 0)
+	section_table.raw = image_range(image, elf_header->Ehdr64->e_shoff,
+			(uint64_t)sizeof(Elf64_Shdr) * elf_header->Ehdr64->e_shnum);
+
+    return section_table;
+}
+
+static union Elf_Dyn read_dynamic_table(const struct elf_image *image, union Elf_Shdr section) {
+
+    union Elf_Dyn dynamic_table = { NULL };
+
+    if (section.raw == NULL)
+	return dynamic_table;
+
+    if (g_elf_class == ELFCLASS32)
+	dynamic_table.raw = image_range(image, section.Shdr32->sh_offset, section.Shdr32->sh_size);
+    else
+	dynamic_table.raw = image_range(image, section.Shdr64->sh_offset, section.Shdr64->sh_size);
+
+    return dynamic_table;
+}
+
+static union Elf_Sym read_symbol_table(const struct elf_image *image, union Elf_Shdr section) {
+
+    union Elf_Sym symbol_table = { NULL };
+
+    if (section.raw == NULL)
+	return symbol_table;
+
+    if (g_elf_class == ELFCLASS32)
+	symbol_table.raw = image_range(image, section.Shdr32->sh_offset, section.Shdr32->sh_size);
+    else
+	symbol_table.raw = image_range(image, section.Shdr64->sh_offset, section.Shdr64->sh_size);
+
+    return symbol_table;
+}
+
+static int read_string_table(const struct elf_image *image, union Elf_Shdr section,
+					    struct Elf_Str *string_table)
+{
+    uint64_t offset, size;
+
+    if (section.raw == NULL)
+        return -EINVAL;
+
+    if (g_elf_class == ELFCLASS32) {
+	size = section.Shdr32->sh_size;
+	offset = section.Shdr32->sh_offset;
+    }
+    else {
+	size = section.Shdr64->sh_size;
+	offset = section.Shdr64->sh_offset;
+    }
+
+    string_table->data = image_range(image, offset, size);
+    string_table->size = size;
+
+    /* Table must be terminated, so every valid index
+     * points to a terminated string
+     */
+    if (string_table->data == NULL || size == 0 || string_table->data[size - 1] != '\0')
+	return -EFAULT;
+
+    return 0;
+}
+
+static inline const unsigned char* string_by_index(const struct Elf_Str *string_table, uint64_t index) {
+
+    if (index >= string_table->size)
+	return NULL;
+
+    return &string_table->data[index];
+}
+
+static inline union Elf_Shdr section_by_type(const union Elf_Ehdr *elf_header,
+		    uint32_t section_type, union Elf_Shdr section_table)
+{
+    size_t i;
+    uint16_t num;
+    union Elf_Shdr section = { NULL };
+
+    if (section_table.raw == NULL)
+	return section;
+
+    if (g_elf_class == ELFCLASS32) {
+	num = elf_header->Ehdr32->e_shnum;
+
+	for (i = 0; i < num; i++) {
+	    if (section_type == section_table.Shdr32[i].sh_type) {
+		section.Shdr32 = &section_table.Shdr32[i];
+		break;
+	    }
+        }
+    }
+    else {
+	num = elf_header->Ehdr64->e_shnum;
+
+	for (i = 0; i < num; i++) {
+	    if (section_type == section_table.Shdr64[i].sh_type) {
+		section.Shdr64 = &section_table.Shdr64[i];
+		break;
+	    }
+        }
+    }
+
+    return section;
+}
+
+static inline union Elf_Shdr section_by_index(const union Elf_Ehdr *elf_header,
+			    uint32_t index, union Elf_Shdr section_table)
+{
+    uint16_t num;
+    union Elf_Shdr section = { NULL };
+
+    if (section_table.raw == NULL)
+	return section;
+
+    if (g_elf_class == ELFCLASS32) {
+	num = elf_header->Ehdr32->e_shnum;
+	if (index < num)
+	    section.Shdr32 = &section_table.Shdr32[index];
+    }
+    else {
+	num = elf_header->Ehdr64->e_shnum;
+	if (index < num)
+	    section.Shdr64 = &section_table.Shdr64[index];
+    }
+
+    return section;
+}
+
+/* Same function as used by .gnu.hash section */
+static inline uint32_t gnu_hash(const unsigned char *name) {
+
+    uint32_t h = 5381;
+
+    while (*name != '\0')
+	h = (h << 5) + h + *name++;
+
+    return h;
+}
+
+static void* arena_alloc(size_t size) {
+
+    void *p;
+    struct arena_chunk *chunk;
+
+    size = (size + 7) & ~(size_t)7;
+
+    chunk = g_arena;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+	/* Reuse chunk of previous target if it fits */
+	if (g_arena_free != NULL && g_arena_free->size >= size) {
+	    chunk = g_arena_free;
+	    g_arena_free = chunk->next;
+	}
+	else {
+	    chunk = (struct arena_chunk *)malloc(sizeof(struct arena_chunk)
+				+ (size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE));
+	    if (chunk == NULL)
+		return NULL;
+	    chunk->size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+	}
+	chunk->used = 0;
+	chunk->next = g_arena;
+	g_arena = chunk;
+    }
+
+    p = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return p;
+}
+
+/* Everything allocated since previous reset is gone */
+static void arena_reset(void) {
+
+    struct arena_chunk *chunk;
+
+    while ((chunk = g_arena) != NULL) {
+	g_arena = chunk->next;
+	chunk->next = g_arena_free;
+	g_arena_free = chunk;
+    }
+}
+
+/* Returns interned copy of name or NULL if there is none */
+static const unsigned char* find_name(const unsigned char *str, uint32_t hash) {
+
+    struct intern_name *name;
+
+    if (g_names == NULL)
+	return NULL;
+
+    for (name = g_names[hash & (g_names_size - 1)]; name != NULL; name = name->next)
+	if (name->hash == hash) {
+	    STAT_ADD(g_stat_strcmp, 1);
+	    if (!strcmp(name->str, str))
+		return name->str;
+	}
+
+    return NULL;
+}
+
+static const unsigned char* intern_name(const unsigned char *str, uint32_t hash) {
+
+    size_t i, size, length;
+    const unsigned char *found;
+    struct intern_name *name, **table;
+
+    if ((found = find_name(str, hash)) != NULL)
+	return found;
+
+    if (g_names_cnt >= g_names_size) {
+	size = g_names_size ? g_names_size * 2 : 1024;
+	table = (struct intern_name **)calloc(size, sizeof(struct intern_name *));
+	if (table == NULL)
+	    return NULL;
+	for (i = 0; i < g_names_size; i++)
+	    while ((name = g_names[i]) != NULL) {
+		g_names[i] = name->next;
+		name->next = table[name->hash & (size - 1)];
+		table[name->hash & (size - 1)] = name;
+	    }
+	free(g_names);
+	g_names = table;
+	g_names_size = size;
+    }
+
+    length = strlen(str);
+    name = (struct intern_name *)arena_alloc(sizeof(struct intern_name) + length + 1);
+    if (name == NULL)
+	return NULL;
+    name->hash = hash;
+    name->lib_id = NO_LIB;
+    name->readahead = 0;
+    memcpy(name->str, str, length + 1);
+    name->next = g_names[hash & (g_names_size - 1)];
+    g_names[hash & (g_names_size - 1)] = name;
+    g_names_cnt++;
+
+    return name->str;
+}
+
+static inline int add_in_lib_list(const unsigned char *libname, uint32_t parent_id) {
+
+    struct intern_name *name;
+    struct lib_list *list;
+    size_t size;
+
+    libname = intern_name(libname, gnu_hash(libname));
+    if (libname == NULL)
+	return -1;
+
+    /* Check if lib is already in list */
+    name = (struct intern_name *)(libname - offsetof(struct intern_name, str));
+    if (name->lib_id != NO_LIB)
+	return name->lib_id;
+
+    if (g_lib_cnt >= NO_LIB || g_lib_cnt > INT_MAX)
+	return -1;
+
+    if (g_lib_cnt >= g_lib_size) {
+	size = g_lib_size ? g_lib_size * 2 : 64;
+	list = (struct lib_list *)realloc(g_liblist, size * sizeof(struct lib_list));
+	if (list == NULL)
+	    return -1;
+	g_liblist = list;
+	g_lib_size = size;
+    }
+
+    g_liblist[g_lib_cnt].name = libname;
+    g_liblist[g_lib_cnt].parent_id = parent_id;
+    g_liblist[g_lib_cnt].depth = g_lib_cnt ? g_liblist[parent_id].depth + 1 : 0;
+    name->lib_id = g_lib_cnt;
+
+    return g_lib_cnt++;
+}
+
+/* Same function as used by .hash section */
+static inline uint32_t elf_hash(const unsigned char *name) {
+
+    uint32_t h = 0, g;
+
+    while (*name != '\0') {
+	h = (h << 4) + *name++;
+	g = h & 0xf0000000;
+	if (g)
+	    h ^= g >> 24;
+	h &= ~g;
+    }
+
+    return h;
+}
+
+/* Readers of symbol and dynamic tables for ELF32 and ELF64 objects.
+ * Instantiated once per class with native ElfN_* layouts,
+ * so that loops over tables don't branch on g_elf_class per entry
+ */
+#define ELF_SYMBOL_FUNCTIONS(bits)							\
+/* Translates virtual address into pointer to image					\
+ * by means of loadable segment or section which contains it				\
+ */											\
+static const void* image_by_address##bits(const struct elf_image *image,		\
+			const struct elf_object *obj, uint64_t addr, uint64_t size)	\
+{											\
+    size_t i;										\
+    const Elf##bits##_Phdr *phdr = obj->program_table.Phdr##bits;			\
+    const Elf##bits##_Shdr *shdr = obj->section_table.Shdr##bits;			\
+											\
+    for (i = 0; phdr != NULL && i < obj->header.Ehdr##bits->e_phnum; i++)		\
+	if (phdr[i].p_type == PT_LOAD && phdr[i].p_vaddr <= addr			\
+	    && addr - phdr[i].p_vaddr < phdr[i].p_filesz)				\
+		return image_range(image, phdr[i].p_offset + (addr - phdr[i].p_vaddr), size); \
+											\
+    for (i = 0; shdr != NULL && i < obj->header.Ehdr##bits->e_shnum; i++)		\
+	if (shdr[i].sh_type != SHT_NOBITS && shdr[i].sh_addr <= addr			\
+	    && addr - shdr[i].sh_addr < shdr[i].sh_size)				\
+		return image_range(image, shdr[i].sh_offset + (addr - shdr[i].sh_addr), size); \
+											\
+    return NULL;									\
+}											\
+											\
+/* Returns value of the first .dynamic entry with tag or 0 */				\
+static uint64_t dynamic_value##bits(const struct elf_object *obj, int64_t tag) {	\
+											\
+    size_t i;										\
+    const Elf##bits##_Dyn *dyn = obj->dynamic_table.Dyn##bits;				\
+											\
+    for (i = 0; i < obj->dyn_cnt && dyn[i].d_tag != DT_NULL; i++)			\
+	if (dyn[i].d_tag == tag)							\
+	    return dyn[i].d_un.d_val;							\
+											\
+    return 0;										\
+}											\
+											\
+static inline int symbol_is_defined##bits(const struct elf_object *obj, size_t index) {	\
+											\
+    uint16_t shndx = obj->symbol_table.Sym##bits[index].st_shndx;			\
+    const Elf##bits##_Shdr *section;							\
+											\
+    /* Without sections only special indexes tell symbol is not defined */		\
+    if (obj->section_table.raw == NULL)							\
+	return shndx != SHN_UNDEF && shndx < SHN_LORESERVE;				\
+    if (shndx == SHN_UNDEF || shndx >= obj->header.Ehdr##bits->e_shnum)			\
+	return 0;									\
+    section = &obj->section_table.Shdr##bits[shndx];					\
+    /* Symbol is in .data or .bss section */						\
+    return section->sh_type == SHT_PROGBITS || section->sh_type == SHT_NOBITS;		\
+}											\
+											\
+static inline int symbol_is_import##bits(const struct elf_object *obj, size_t index) {	\
+											\
+    return obj->symbol_table.Sym##bits[index].st_shndx == SHN_UNDEF			\
+	/* Skip weak symbols */								\
+	&& ELF##bits##_ST_BIND(obj->symbol_table.Sym##bits[index].st_info) != STB_WEAK;	\
+}											\
+											\
+static inline const unsigned char* symbol_name##bits(const struct elf_object *obj, size_t index) { \
+											\
+    return string_by_index(&obj->string_table, obj->symbol_table.Sym##bits[index].st_name); \
+}											\
+											\
+static inline int symbol_has_name##bits(const struct elf_object *obj, size_t index,	\
+						const unsigned char *symbol)		\
+{											\
+    const unsigned char *name = symbol_name##bits(obj, index);				\
+											\
+    STAT_ADD(g_stat_strcmp, 1);								\
+    return name != NULL && !strcmp(name, symbol);					\
+}											\
+											\
+/* Probe hash table of an object for defined symbol.					\
+ * Returns 1 if symbol is found, 0 otherwise						\
+ */											\
+static int lookup_symbol##bits(const struct elf_object *obj, const unsigned char *symbol, \
+						uint32_t hash_value)			\
+{											\
+    const struct Elf_Hash *hash = &obj->hash;						\
+    uint32_t i, h, steps;								\
+											\
+    if (hash->type == DT_GNU_HASH) {							\
+	Elf##bits##_Addr word, mask;							\
+											\
+	/* Bloom filter rejects most of absent symbols */				\
+	word = hash->bloom.Bloom##bits[(hash_value / bits) & (hash->bloom_size - 1)];	\
+	mask = ((Elf##bits##_Addr)1 << (hash_value % bits))				\
+	    | ((Elf##bits##_Addr)1 << ((hash_value >> hash->bloom_shift) % bits));	\
+	if ((word & mask) != mask)							\
+	    return 0;									\
+											\
+	i = hash->buckets[hash_value % hash->nbuckets];					\
+	if (i < hash->symoffset)							\
+	    return 0;									\
+											\
+	for (; i < obj->sym_cnt; i++) {							\
+	    h = hash->chain[i - hash->symoffset];					\
+	    if ((h | 1) == (hash_value | 1) && symbol_has_name##bits(obj, i, symbol)	\
+		&& symbol_is_defined##bits(obj, i))					\
+		    return 1;								\
+	    /* Last symbol in chain */							\
+	    if (h & 1)									\
+		break;									\
+	}										\
+    }											\
+    else if (hash->type == DT_HASH) {							\
+	h = elf_hash(symbol);								\
+	i = hash->buckets[h % hash->nbuckets];						\
+	/* Bound number of steps in case of looped chain */				\
+	for (steps = 0; i != STN_UNDEF && i < hash->nchain && i < obj->sym_cnt && steps < hash->nchain; steps++) { \
+	    if (symbol_has_name##bits(obj, i, symbol) && symbol_is_defined##bits(obj, i)) \
+		return 1;								\
+	    i = hash->chain[i];								\
+	}										\
+    }											\
+											\
+    return 0;										\
+}											\
+											\
+/* Count dynamic symbols by hash table as loader does without sections.		\
+ * Returns 0 if object has no usable hash table						\
+ */											\
+static size_t count_symbols##bits(const struct elf_image *image, const struct elf_object *obj) \
+{											\
+    size_t i, cnt = 0;									\
+    uint64_t addr;									\
+    const uint32_t *words, *buckets, *chain;						\
+											\
+    if ((addr = dynamic_value##bits(obj, DT_GNU_HASH)) != 0				\
+	&& (words = image_by_address##bits(image, obj, addr, 4 * sizeof(uint32_t))) != NULL) { \
+	addr += 4 * sizeof(uint32_t) + (uint64_t)words[2] * sizeof(Elf##bits##_Addr);	\
+	buckets = image_by_address##bits(image, obj, addr, (uint64_t)words[0] * sizeof(uint32_t)); \
+	if (buckets == NULL)								\
+	    return 0;									\
+	/* The highest bucket starts the last chain */					\
+	for (i = 0; i < words[0]; i++)							\
+	    if (buckets[i] > cnt)							\
+		cnt = buckets[i];							\
+	if (cnt == 0 || cnt < words[1])							\
+	    return words[1];								\
+	addr += (uint64_t)words[0] * sizeof(uint32_t);					\
+	while ((chain = image_by_address##bits(image, obj,				\
+			addr + (uint64_t)(cnt - words[1]) * sizeof(uint32_t), sizeof(uint32_t))) != NULL) { \
+	    cnt++;									\
+	    if (*chain & 1)								\
+		return cnt;								\
+	}										\
+	return 0;									\
+    }											\
+											\
+    if ((addr = dynamic_value##bits(obj, DT_HASH)) != 0					\
+	&& (words = image_by_address##bits(image, obj, addr, 2 * sizeof(uint32_t))) != NULL) \
+	return words[1];								\
+											\
+    return 0;										\
+}											\
+											\
+/* Reach dynamic symbols through PT_DYNAMIC like the loader does,			\
+ * so neither section table is scanned nor stripped sections matter.			\
+ * Returns -ENOENT if object has no PT_DYNAMIC segment					\
+ */											\
+static int parse_dynamic##bits(const struct elf_image *image, struct elf_object *obj,	\
+						const char **error)			\
+{											\
+    size_t i;										\
+    uint64_t symtab, strtab, strsz;							\
+    union Elf_Shdr dynsym;								\
+    const Elf##bits##_Phdr *phdr = obj->program_table.Phdr##bits, *dynamic = NULL;	\
+											\
+    for (i = 0; phdr != NULL && i < obj->header.Ehdr##bits->e_phnum; i++)		\
+	if (phdr[i].p_type == PT_DYNAMIC) {						\
+	    dynamic = &phdr[i];								\
+	    break;									\
+	}										\
+    if (dynamic == NULL)								\
+	return -ENOENT;									\
+											\
+    obj->dynamic_table.raw = image_range(image, dynamic->p_offset, dynamic->p_filesz);	\
+    if (obj->dynamic_table.raw == NULL) {						\
+	*error = "Error occured while reading .dynamic segment";			\
+	return -EFAULT;									\
+    }											\
+    obj->dyn_cnt = dynamic->p_filesz / sizeof(Elf##bits##_Dyn);				\
+											\
+    symtab = dynamic_value##bits(obj, DT_SYMTAB);					\
+    strtab = dynamic_value##bits(obj, DT_STRTAB);					\
+    strsz = dynamic_value##bits(obj, DT_STRSZ);						\
+											\
+    /* Without hash table take size of .dynsym if there is one,			\
+     * otherwise string table is expected right after symbol table			\
+     */											\
+    obj->sym_cnt = count_symbols##bits(image, obj);					\
+    if (obj->sym_cnt == 0) {								\
+	dynsym = section_by_type(&obj->header, SHT_DYNSYM, obj->section_table);		\
+	if (dynsym.raw != NULL)								\
+	    obj->sym_cnt = dynsym.Shdr##bits->sh_size / sizeof(Elf##bits##_Sym);	\
+	else if (strtab > symtab)							\
+	    obj->sym_cnt = (strtab - symtab) / sizeof(Elf##bits##_Sym);			\
+    }											\
+											\
+    obj->symbol_table.raw = symtab == 0 ? NULL : image_by_address##bits(image, obj,	\
+			symtab, (uint64_t)obj->sym_cnt * sizeof(Elf##bits##_Sym));	\
+    if (obj->symbol_table.raw == NULL) {						\
+	*error = "Error occured while reading DT_SYMTAB table";				\
+	return -EFAULT;									\
+    }											\
+											\
+    /* Table must be terminated, as with .dynstr section */				\
+    obj->string_table.data = strtab == 0 ? NULL : image_by_address##bits(image, obj, strtab, strsz); \
+    obj->string_table.size = strsz;							\
+    if (obj->string_table.data == NULL || strsz == 0 || obj->string_table.data[strsz - 1] != '\0') { \
+	*error = "Error occured while reading DT_STRTAB table";				\
+	return -EFAULT;									\
+    }											\
+											\
+    return 0;										\
+}											\
+											\
+/* Count needed libs and imports, collect exports for export index.			\
+ * Returns number of exports								\
+ */											\
+static size_t scan_symbols##bits(const struct elf_object *obj, struct cache_export *exports, \
+			size_t *needed_cnt, size_t *import_cnt, size_t *strings_size)	\
+{											\
+    size_t i, export_cnt = 0;								\
+    const unsigned char *name;								\
+    const Elf##bits##_Dyn *dyn = obj->dynamic_table.Dyn##bits;				\
+											\
+    for (i = 0; i < obj->dyn_cnt && dyn[i].d_tag != DT_NULL; i++)			\
+	if (dyn[i].d_tag == DT_NEEDED && (name = string_by_index(&obj->string_table, dyn[i].d_un.d_val)) != NULL) { \
+	    (*needed_cnt)++;								\
+	    *strings_size += strlen(name) + 1;						\
+	}										\
+											\
+    for (i = 0; i < obj->sym_cnt; i++) {						\
+	name = symbol_name##bits(obj, i);						\
+	if (name == NULL || *name == '\0')						\
+	    continue;									\
+	if (symbol_is_import##bits(obj, i)) {						\
+	    (*import_cnt)++;								\
+	    *strings_size += strlen(name) + 1;						\
+	}										\
+	else if (symbol_is_defined##bits(obj, i)) {					\
+	    exports[export_cnt].name = name;						\
+	    exports[export_cnt].hash = gnu_hash(name);					\
+	    export_cnt++;								\
+	}										\
+    }											\
+											\
+    return export_cnt;									\
+}											\
+											\
+/* Copy names of needed libs and imports, returns end of copied strings */		\
+static unsigned char* copy_strings##bits(const struct elf_object *obj, unsigned char *p) { \
+											\
+    size_t i;										\
+    const unsigned char *name;								\
+    const Elf##bits##_Dyn *dyn = obj->dynamic_table.Dyn##bits;				\
+											\
+    for (i = 0; i < obj->dyn_cnt && dyn[i].d_tag != DT_NULL; i++)			\
+	if (dyn[i].d_tag == DT_NEEDED && (name = string_by_index(&obj->string_table, dyn[i].d_un.d_val)) != NULL) \
+	    p = stpcpy(p, name) + 1;							\
+											\
+    for (i = 0; i < obj->sym_cnt; i++) {						\
+	name = symbol_name##bits(obj, i);						\
+	if (name != NULL && *name != '\0' && symbol_is_import##bits(obj, i))		\
+	    p = stpcpy(p, name) + 1;							\
+    }											\
+											\
+    return p;										\
+}
+
+ELF_SYMBOL_FUNCTIONS(32)
+ELF_SYMBOL_FUNCTIONS(64)
+
+static inline const void* image_by_address(const struct elf_image *image, const struct elf_object *obj,
+						    uint64_t addr, uint64_t size)
+{
+    if (g_elf_class == ELFCLASS32)
+	return image_by_address32(image, obj, addr, size);
+    else
+	return image_by_address64(image, obj, addr, size);
+}
+
+static inline int lookup_symbol(const struct elf_object *obj, const unsigned char *symbol, uint32_t hash_value) {
+
+    if (g_elf_class == ELFCLASS32)
+	return lookup_symbol32(obj, symbol, hash_value);
+    else
+	return lookup_symbol64(obj, symbol, hash_value);
+}
+
+/* Locate .gnu.hash or .hash table through .dynamic section.
+ * GNU variant is preferred since it has Bloom filter
+ */
+static void read_hash_table(const struct elf_image *image, struct elf_object *obj) {
+
+    size_t word_size;
+    uint64_t gnu_addr, sysv_addr;
+    const uint32_t *words;
+    struct Elf_Hash *hash = &obj->hash;
+
+    memset(hash, 0, sizeof(struct Elf_Hash));
+    hash->type = DT_NULL;
+
+    if (g_elf_class == ELFCLASS32) {
+	gnu_addr = dynamic_value32(obj, DT_GNU_HASH);
+	sysv_addr = dynamic_value32(obj, DT_HASH);
+    }
+    else {
+	gnu_addr = dynamic_value64(obj, DT_GNU_HASH);
+	sysv_addr = dynamic_value64(obj, DT_HASH);
+    }
+
+    if (gnu_addr != 0 && (words = image_by_address(image, obj, gnu_addr, 4 * sizeof(uint32_t))) != NULL) {
+	word_size = g_elf_class == ELFCLASS32 ? sizeof(Elf32_Addr) : sizeof(Elf64_Addr);
+	hash->nbuckets = words[0];
+	hash->symoffset = words[1];
+	hash->bloom_size = words[2];
+	hash->bloom_shift = words[3];
+	hash->bloom.raw = image_by_address(image, obj, gnu_addr + 4 * sizeof(uint32_t),
+			    (uint64_t)hash->bloom_size * word_size);
+	hash->buckets = image_by_address(image, obj, gnu_addr + 4 * sizeof(uint32_t)
+			    + (uint64_t)hash->bloom_size * word_size, (uint64_t)hash->nbuckets * sizeof(uint32_t));
+	/* Chain covers all symbols starting from symoffset */
+	if (hash->symoffset <= obj->sym_cnt)
+	    hash->chain = image_by_address(image, obj, gnu_addr + 4 * sizeof(uint32_t)
+			    + (uint64_t)hash->bloom_size * word_size + (uint64_t)hash->nbuckets * sizeof(uint32_t),
+			    (uint64_t)(obj->sym_cnt - hash->symoffset) * sizeof(uint32_t));
+
+	if (hash->nbuckets != 0 && hash->bloom_size != 0 && (hash->bloom_size & (hash->bloom_size - 1)) == 0
+	    && hash->bloom.raw != NULL && hash->buckets != NULL && hash->chain != NULL) {
+		hash->type = DT_GNU_HASH;
+		return;
+	}
+	memset(hash, 0, sizeof(struct Elf_Hash));
+    }
+
+    if (sysv_addr != 0 && (words = image_by_address(image, obj, sysv_addr, 2 * sizeof(uint32_t))) != NULL) {
+	hash->nbuckets = words[0];
+	hash->nchain = words[1];
+	hash->buckets = image_by_address(image, obj, sysv_addr + 2 * sizeof(uint32_t),
+			    (uint64_t)hash->nbuckets * sizeof(uint32_t));
+	hash->chain = image_by_address(image, obj, sysv_addr + 2 * sizeof(uint32_t)
+			    + (uint64_t)hash->nbuckets * sizeof(uint32_t), (uint64_t)hash->nchain * sizeof(uint32_t));
+
+	if (hash->nbuckets != 0 && hash->buckets != NULL && hash->chain != NULL) {
+	    hash->type = DT_HASH;
+	    return;
+	}
+	memset(hash, 0, sizeof(struct Elf_Hash));
+    }
+
+    hash->type = DT_NULL;
+}
+
+/* Look for NT_GNU_BUILD_ID note in [offset, offset + size) range of image */
+static int find_build_id(const struct elf_image *image, uint64_t offset, uint64_t size,
+			const unsigned char **build_id, uint8_t *build_id_len)
+{
+    uint64_t pos;
+    const Elf32_Nhdr *note;	/* Same layout for both classes */
+    const void *name;
+
+    for (pos = 0; pos + sizeof(Elf32_Nhdr) <= size;) {
+	note = image_range(image, offset + pos, sizeof(Elf32_Nhdr));
+	if (note == NULL)
+	    break;
+	name = image_range(image, offset + pos + sizeof(Elf32_Nhdr), note->n_namesz);
+	pos += sizeof(Elf32_Nhdr) + ((note->n_namesz + 3) & ~3U);
+	if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && note->n_descsz <= UINT8_MAX
+	    && name != NULL && !memcmp(name, "GNU", 4)
+	    && (*build_id = image_range(image, offset + pos, note->n_descsz)) != NULL) {
+		*build_id_len = note->n_descsz;
+		return 0;
+	}
+	pos += (note->n_descsz + 3) & ~3U;
+    }
+
+    return -ENOENT;
+}
+
+/* Look for build-id in SHT_NOTE sections,
+ * or in PT_NOTE segments if sections are stripped
+ */
+static int read_build_id(const struct elf_image *image, const struct elf_object *obj,
+			const unsigned char **build_id, uint8_t *build_id_len)
+{
+    size_t i;
+    uint16_t shnum = 0, phnum = 0;
+
+    if (obj->section_table.raw != NULL)
+	shnum = g_elf_class == ELFCLASS32 ? obj->header.Ehdr32->e_shnum : obj->header.Ehdr64->e_shnum;
+    else if (obj->program_table.raw != NULL)
+	phnum = g_elf_class == ELFCLASS32 ? obj->header.Ehdr32->e_phnum : obj->header.Ehdr64->e_phnum;
+
+    for (i = 0; i < shnum; i++)
+	if (g_elf_class == ELFCLASS32) {
+	    if (obj->section_table.Shdr32[i].sh_type == SHT_NOTE
+		&& find_build_id(image, obj->section_table.Shdr32[i].sh_offset,
+				 obj->section_table.Shdr32[i].sh_size, build_id, build_id_len) == 0)
+		return 0;
+	}
+	else if (obj->section_table.Shdr64[i].sh_type == SHT_NOTE
+		 && find_build_id(image, obj->section_table.Shdr64[i].sh_offset,
+				  obj->section_table.Shdr64[i].sh_size, build_id, build_id_len) == 0)
+	    return 0;
+
+    for (i = 0; i < phnum; i++)
+	if (g_elf_class == ELFCLASS32) {
+	    if (obj->program_table.Phdr32[i].p_type == PT_NOTE
+		&& find_build_id(image, obj->program_table.Phdr32[i].p_offset,
+				 obj->program_table.Phdr32[i].p_filesz, build_id, build_id_len) == 0)
+		return 0;
+	}
+	else if (obj->program_table.Phdr64[i].p_type == PT_NOTE
+		 && find_build_id(image, obj->program_table.Phdr64[i].p_offset,
+				  obj->program_table.Phdr64[i].p_filesz, build_id, build_id_len) == 0)
+	    return 0;
+
+    *build_id = NULL;
+    *build_id_len = 0;
+
+    return -ENOENT;
+}
+
+/* Read range of file, which is either opened or found in image file */
+static int read_range(int fd, const struct vnode *node, void *buf, size_t size, uint64_t offset) {
+
+    if (fd < 0)
+	return node_read(node, buf, size, offset);
+
+    STAT_ADD(g_stat_syscalls, 1);
+    return pread(fd, buf, size, offset) == (ssize_t)size ? 0 : -EIO;
+}
+
+/* Read build-id from PT_NOTE segments without mapping the file,
+ * so that unchanged lib can be checked against its index record
+ */
+static int probe_build_id(const unsigned char *path, unsigned char *build_id, uint8_t *build_id_len) {
+
+    int fd, ret;
+    struct vnode node;
+    union {
+	Elf32_Ehdr e32;
+	Elf64_Ehdr e64;
+    } ehdr;
+    struct elf_image notes = { NULL };
+    unsigned char *phdrs = NULL;
+    uint64_t phoff, offset, size;
+    uint16_t phnum, phentsize;
+    uint8_t elf_class;
+    const unsigned char *id;
+    size_t i;
+
+    fd = open(path, O_RDONLY);
+    STAT_ADD(g_stat_syscalls, 1);
+    if (fd < 0) {
+	if (errno != ENOTDIR)
+	    return -errno;
+	if ((ret = vfs_lookup(path, &node)) < 0)
+	    return ret;
+    }
+
+    if ((ret = read_range(fd, &node, &ehdr, sizeof(ehdr), 0)) < 0)
+	goto exit;
+    elf_class = ehdr.e32.e_ident[EI_CLASS];
+    if (memcmp(ehdr.e32.e_ident, ELFMAG, SELFMAG) || (elf_class != ELFCLASS32 && elf_class != ELFCLASS64)) {
+	ret = -EINVAL;
+	goto exit;
+    }
+    phoff = elf_class == ELFCLASS32 ? ehdr.e32.e_phoff : ehdr.e64.e_phoff;
+    phnum = elf_class == ELFCLASS32 ? ehdr.e32.e_phnum : ehdr.e64.e_phnum;
+    phentsize = elf_class == ELFCLASS32 ? sizeof(Elf32_Phdr) : sizeof(Elf64_Phdr);
+
+    /* Object without program headers has no build-id note */
+    if (phnum == 0) {
+	ret = -ENOENT;
+	goto exit;
+    }
+    phdrs = (unsigned char *)malloc((size_t)phnum * phentsize);
+    if (phdrs == NULL) {
+	ret = -ENOMEM;
+	goto exit;
+    }
+    if ((ret = read_range(fd, &node, phdrs, (size_t)phnum * phentsize, phoff)) < 0)
+	goto exit;
+
+    ret = -ENOENT;
+    for (i = 0; i < phnum && ret == -ENOENT; i++) {
+	if (elf_class == ELFCLASS32) {
+	    if (((Elf32_Phdr *)phdrs)[i].p_type != PT_NOTE)
+		continue;
+	    offset = ((Elf32_Phdr *)phdrs)[i].p_offset;
+	    size = ((Elf32_Phdr *)phdrs)[i].p_filesz;
+	}
+	else {
+	    if (((Elf64_Phdr *)phdrs)[i].p_type != PT_NOTE)
+		continue;
+	    offset = ((Elf64_Phdr *)phdrs)[i].p_offset;
+	    size = ((Elf64_Phdr *)phdrs)[i].p_filesz;
+	}
+	if (size > NOTE_SIZE_MAX || (notes.base = (unsigned char *)malloc(size)) == NULL)
+	    continue;
+	notes.size = size;
+	if (read_range(fd, &node, (void *)notes.base, size, offset) == 0
+	    && find_build_id(&notes, 0, size, &id, build_id_len) == 0) {
+		memcpy(build_id, id, *build_id_len);
+		ret = 0;
+	}
+	free((void *)notes.base);
+    }
+
+exit:
+    free(phdrs);
+    if (fd >= 0)
+	close(fd);
+    else
+	node_free(&node);
+    return ret;
+}
+
+static inline size_t sym_bucket(uint32_t hash, uint32_t lib_id, size_t size) {
+
+    return (hash ^ (lib_id * 0x9e3779b1U)) & (size - 1);
+}
+
+/* Symbol has to be interned */
+static struct sym_list* find_in_sym_list(const unsigned char *symbol, uint32_t hash, uint32_t lib_id) {
+
+    struct sym_list *val;
+
+    if (g_symhash == NULL)
+	return NULL;
+
+    val = g_symhash[sym_bucket(hash, lib_id, g_symhash_size)];
+    while (val != NULL) {
+	if (val->symbol == symbol && val->lib_id == lib_id)
+	    return val;
+	val = val->hash_next;
+    }
+
+    return NULL;
+}
+
+/* Keep load factor below 1 */
+static int grow_sym_hash(void) {
+
+    size_t i, size;
+    struct sym_list **table, *val;
+
+    size = g_symhash_size ? g_symhash_size * 2 : 1024;
+    table = (struct sym_list **)calloc(size, sizeof(struct sym_list *));
+    if (table == NULL)
+	return -ENOMEM;
+
+    for (val = g_symlist; val != NULL; val = val->next) {
+	i = sym_bucket(val->hash, val->lib_id, size);
+	val->hash_next = table[i];
+	table[i] = val;
+    }
+
+    free(g_symhash);
+    g_symhash = table;
+    g_symhash_size = size;
+
+    return 0;
+}
+
+static inline void add_in_sym_list(const unsigned char *symbol, uint32_t lib_id) {
+
+    struct sym_list *val;
+    size_t i;
+    uint32_t hash;
+
+    /* Check if symbol is already in list */
+    hash = gnu_hash(symbol);
+    symbol = intern_name(symbol, hash);
+    if (symbol == NULL || find_in_sym_list(symbol, hash, lib_id) != NULL)
+	return;
+
+    if (g_sym_cnt >= g_symhash_size && grow_sym_hash() < 0)
+	return;
+
+    if (lib_id >= g_lib_syms_size) {
+	size_t size = g_lib_syms_size ? g_lib_syms_size : 64;
+	struct lib_syms *lib_syms;
+
+	while (size <= lib_id)
+	    size *= 2;
+	lib_syms = (struct lib_syms *)realloc(g_lib_syms, size * sizeof(struct lib_syms));
+	if (lib_syms == NULL)
+	    return;
+	memset(lib_syms + g_lib_syms_size, 0, (size - g_lib_syms_size) * sizeof(struct lib_syms));
+	g_lib_syms = lib_syms;
+	g_lib_syms_size = size;
+    }
+
+    val = (struct sym_list *)arena_alloc(sizeof(struct sym_list));
+    if (val == NULL)
+	return;
+
+    val->symbol = symbol;
+    val->found = 0;
+    val->lib_id = lib_id;
+    val->hash = hash;
+    val->next = NULL;
+
+    if (g_symlist == NULL)
+	g_symlist = val;
+    else
+	g_symlist_tail->next = val;
+    g_symlist_tail = val;
+
+    i = sym_bucket(hash, lib_id, g_symhash_size);
+    val->hash_next = g_symhash[i];
+    g_symhash[i] = val;
+    g_sym_cnt++;
+    STAT_ADD(g_stat_inserted, 1);
+
+    val->lib_next = NULL;
+    if (g_lib_syms[lib_id].head == NULL)
+	g_lib_syms[lib_id].head = val;
+    else
+	g_lib_syms[lib_id].tail->lib_next = val;
+    g_lib_syms[lib_id].tail = val;
+}
+
+static inline const uint32_t* cache_record_hashes(const struct cache_record *rec) {
+
+    return (const uint32_t *)(rec + 1);
+}
+
+static inline const unsigned char* cache_record_build_id(const struct cache_record *rec) {
+
+    return (const unsigned char *)(cache_record_hashes(rec) + rec->export_cnt);
+}
+
+static inline const unsigned char* cache_record_path(const struct cache_record *rec) {
+
+    return cache_record_build_id(rec) + rec->build_id_len;
+}
+
+static inline const unsigned char* cache_record_strings(const struct cache_record *rec) {
+
+    return cache_record_path(rec) + rec->path_len;
+}
+
+static int cache_record_valid(const struct cache_record *rec) {
+
+    uint64_t size;
+
+    size = sizeof(struct cache_record) + (uint64_t)rec->export_cnt * sizeof(uint32_t)
+	    + rec->build_id_len + rec->path_len + rec->strings_size;
+    if (size > rec->record_size || rec->path_len == 0)
+	return 0;
+
+    if (cache_record_path(rec)[rec->path_len - 1] != '\0')
+	return 0;
+
+    if (rec->strings_size != 0 && cache_record_strings(rec)[rec->strings_size - 1] != '\0')
+	return 0;
+
+    return 1;
+}
+
+/* Split strings of record into needed libs, imports and exports */
+static int cache_decode(struct cache_entry *entry) {
+
+    const struct cache_record *rec = entry->rec;
+    const unsigned char *p, *end;
+    const uint32_t *hashes;
+    uint64_t *bloom;
+    size_t i, n, offset, words = 1;
+
+    /* At least 16 bits of filter per export */
+    while (words * 4 < rec->export_cnt)
+	words <<= 1;
+
+    n = (size_t)rec->needed_cnt + rec->import_cnt + rec->export_cnt;
+    offset = ((n + 1) * sizeof(unsigned char *) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    entry->strings = (const unsigned char **)malloc(offset + words * sizeof(uint64_t));
+    if (entry->strings == NULL)
+	return -ENOMEM;
+
+    p = cache_record_strings(rec);
+    end = p + rec->strings_size;
+    for (i = 0; i < n && p < end; i++) {
+	entry->strings[i] = p;
+	p += strlen(p) + 1;
+    }
+
+    if (i != n || p != end) {
+	free(entry->strings);
+	entry->strings = NULL;
+	return -EINVAL;
+    }
+
+    entry->needed = entry->strings;
+    entry->imports = entry->needed + rec->needed_cnt;
+    entry->exports = entry->imports + rec->import_cnt;
+
+    /* Two bits per export in one word like in .gnu.hash,
+     * so that most of absent symbols cost one load
+     */
+    bloom = (uint64_t *)((unsigned char *)entry->strings + offset);
+    memset(bloom, 0, words * sizeof(uint64_t));
+    hashes = cache_record_hashes(rec);
+    for (i = 0; i < rec->export_cnt; i++)
+	bloom[(hashes[i] / 64) & (words - 1)] |= ((uint64_t)1 << (hashes[i] % 64))
+	    | ((uint64_t)1 << ((hashes[i] >> BLOOM_SHIFT) % 64));
+    entry->bloom = bloom;
+    entry->bloom_mask = words - 1;
+
+    return 0;
+}
+
+/* Put record in index replacing previous record for the same path */
+static struct cache_entry* cache_insert(const struct cache_record *rec, uint8_t owned) {
+
+    struct cache_entry *entry, **table;
+    size_t i, size;
+    const unsigned char *path = cache_record_path(rec);
+
+    entry = g_cache_size ? g_cache[gnu_hash(path) & (g_cache_size - 1)] : NULL;
+    for (; entry != NULL; entry = entry->next)
+	if (!strcmp(cache_record_path(entry->rec), path)) {
+	    if (entry->owned)
+		free((void *)entry->rec);
+	    free(entry->strings);
+	    entry->strings = NULL;
+	    entry->rec = rec;
+	    entry->owned = owned;
+	    entry->verified = 0;
+	    entry->symdb = 0;
+	    return entry;
+	}
+
+    if (g_cache_cnt >= g_cache_size) {
+	size = g_cache_size ? g_cache_size * 2 : 256;
+	table = (struct cache_entry **)calloc(size, sizeof(struct cache_entry *));
+	if (table == NULL)
+	    return NULL;
+	for (i = 0; i < g_cache_size; i++)
+	    while ((entry = g_cache[i]) != NULL) {
+		g_cache[i] = entry->next;
+		entry->next = table[gnu_hash(cache_record_path(entry->rec)) & (size - 1)];
+		table[gnu_hash(cache_record_path(entry->rec)) & (size - 1)] = entry;
+	    }
+	free(g_cache);
+	g_cache = table;
+	g_cache_size = size;
+    }
+
+    entry = (struct cache_entry *)calloc(1, sizeof(struct cache_entry));
+    if (entry == NULL)
+	return NULL;
+
+    entry->rec = rec;
+    entry->owned = owned;
+    i = gnu_hash(path) & (g_cache_size - 1);
+    entry->next = g_cache[i];
+    g_cache[i] = entry;
+    g_cache_cnt++;
+
+    return entry;
+}
+
+/* Persistent export index.
+ * File consists of "SYMDEPX1" magic followed by records
+ * each aligned to 8 bytes
+ */
+static int cache_load(void) {
+
+    int fd;
+    struct stat st;
+    const unsigned char *p, *end;
+    const struct cache_record *rec;
+    unsigned char *xdg, *home;
+
+    xdg = getenv("XDG_CACHE_HOME");
+    home = getenv("HOME");
+    if (xdg != NULL && *xdg != '\0')
+	snprintf(g_cache_path, PATH_MAX, "%s/symdep/index", xdg);
+    else if (home != NULL)
+	snprintf(g_cache_path, PATH_MAX, "%s/.cache/symdep/index", home);
+    else
+	return -ENOENT;
+
+    fd = open(g_cache_path, O_RDONLY);
+    if (fd < 0)
+	return -errno;
+
+    if (fstat(fd, &st) < 0 || st.st_size < CACHE_MAGIC_SIZE) {
+	close(fd);
+	return -EINVAL;
+    }
+
+    g_cache_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (g_cache_map == MAP_FAILED) {
+	g_cache_map = NULL;
+	return -errno;
+    }
+    g_cache_map_size = st.st_size;
+
+    if (memcmp(g_cache_map, CACHE_MAGIC, CACHE_MAGIC_SIZE))
+	return -EINVAL;
+
+    p = g_cache_map + CACHE_MAGIC_SIZE;
+    end = g_cache_map + g_cache_map_size;
+    while ((size_t)(end - p) >= sizeof(struct cache_record)) {
+	rec = (const struct cache_record *)p;
+	if (rec->record_size < sizeof(struct cache_record) || rec->record_size % 8
+	    || rec->record_size > end - p)
+		break;
+	/* Skip broken records */
+	if (cache_record_valid(rec))
+	    cache_insert(rec, 0);
+	p += rec->record_size;
+    }
+
+    return 0;
+}
+
+static int cache_save(void) {
+
+    int fd;
+    size_t i;
+    struct cache_entry *entry;
+    unsigned char tmp_path[PATH_MAX + 8], dir[PATH_MAX];
+
+    if (!g_cache_dirty || g_cache_path[0] == '\0')
+	return 0;
+
+    /* Create symdep directory and its parent if necessary */
+    strcpy(dir, g_cache_path);
+    dirname(dir);
+    if (access(dir, F_OK)) {
+	unsigned char parent[PATH_MAX];
+
+	strcpy(parent, dir);
+	mkdir(dirname(parent), 0755);
+	if (mkdir(dir, 0755) < 0)
+	    return -errno;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", g_cache_path, getpid());
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+	return -errno;
+
+    if (write(fd, CACHE_MAGIC, CACHE_MAGIC_SIZE) != CACHE_MAGIC_SIZE)
+	goto error;
+
+    /* Records of objects which were deleted or renamed are dropped,
+     * the ones checked in this run are known to exist
+     */
+    for (i = 0; i < g_cache_size; i++)
+	for (entry = g_cache[i]; entry != NULL; entry = entry->next) {
+	    if (entry->symdb || (!entry->verified && access_path(cache_record_path(entry->rec), F_OK)))
+		continue;
+	    if (write(fd, entry->rec, entry->rec->record_size) != entry->rec->record_size)
+		goto error;
+	}
+
+    close(fd);
+    /* Replace index atomically */
+    if (rename(tmp_path, g_cache_path) < 0) {
+	unlink(tmp_path);
+	return -errno;
+    }
+    g_cache_dirty = 0;
+
+    return 0;
+
+error:
+    close(fd);
+    unlink(tmp_path);
+    return -EIO;
+}
+
+/* Returns cached entry if it matches the file */
+static struct cache_entry* cache_lookup(const unsigned char *path, const struct elf_image *image,
+			const unsigned char *build_id, uint8_t build_id_len)
+{
+    struct cache_entry *entry;
+
+    pthread_mutex_lock(&g_cache_lock);
+
+    entry = g_cache_size ? g_cache[gnu_hash(path) & (g_cache_size - 1)] : NULL;
+    for (; entry != NULL; entry = entry->next)
+	if (!strcmp(cache_record_path(entry->rec), path))
+	    break;
+
+    if (entry == NULL || entry->rec->size != image->size
+	|| entry->rec->mtime_sec != image->mtime.tv_sec
+	|| entry->rec->mtime_nsec != image->mtime.tv_nsec
+	|| entry->rec->elf_class != g_elf_class
+	|| entry->rec->build_id_len != build_id_len
+	|| (build_id_len != 0 && memcmp(cache_record_build_id(entry->rec), build_id, build_id_len))
+	|| (entry->strings == NULL && cache_decode(entry) < 0))
+	    entry = NULL;
+    else
+	entry->verified = 1;
+
+    pthread_mutex_unlock(&g_cache_lock);
+
+    return entry;
+}
+
+/* Returns entry of lib whose size and modification time match its record,
+ * lib is only read for build-id if the record has one.
+ * ELF class of record is taken if any_class is set
+ */
+static struct cache_entry* cache_probe(const unsigned char *path, uint8_t any_class) {
+
+    struct cache_entry *entry;
+    struct elf_image key = { NULL };
+    struct stat st;
+    unsigned char build_id[UINT8_MAX];
+    uint8_t build_id_len = 0, elf_class = ELFCLASSNONE, has_id = 0;
+    int ret;
+
+    if (stat_path(path, &st) < 0)
+	return NULL;
+    STAT_ADD(g_stat_syscalls, 1);
+
+    pthread_mutex_lock(&g_cache_lock);
+    entry = g_cache_size ? g_cache[gnu_hash(path) & (g_cache_size - 1)] : NULL;
+    for (; entry != NULL; entry = entry->next)
+	if (!strcmp(cache_record_path(entry->rec), path))
+	    break;
+    if (entry != NULL && !entry->symdb && entry->rec->size == (uint64_t)st.st_size
+	&& entry->rec->mtime_sec == st.st_mtim.tv_sec && entry->rec->mtime_nsec == st.st_mtim.tv_nsec
+	&& (any_class || entry->rec->elf_class == g_elf_class)) {
+	    elf_class = entry->rec->elf_class;
+	    has_id = entry->rec->build_id_len != 0;
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+
+    if (elf_class == ELFCLASSNONE)
+	return NULL;
+    if (has_id && (ret = probe_build_id(path, build_id, &build_id_len)) < 0 && ret != -ENOENT)
+	return NULL;
+
+    /* Record is checked again, it may have been replaced meanwhile */
+    key.size = st.st_size;
+    key.mtime = st.st_mtim;
+    if (any_class)
+	g_elf_class = elf_class;
+
+    return cache_lookup(path, &key, build_id, build_id_len);
+}
+
+/* Returns entry which was already checked against the file,
+ * so file doesn't need to be opened again
+ */
+static struct cache_entry* cache_find(const unsigned char *path) {
+
+    struct cache_entry *entry;
+
+    pthread_mutex_lock(&g_cache_lock);
+
+    entry = g_cache_size ? g_cache[gnu_hash(path) & (g_cache_size - 1)] : NULL;
+    for (; entry != NULL; entry = entry->next)
+	if (!strcmp(cache_record_path(entry->rec), path))
+	    break;
+    if (entry != NULL && !entry->verified)
+	entry = NULL;
+    /* Records of symdb are split on first use */
+    if (entry != NULL && entry->strings == NULL && cache_decode(entry) < 0)
+	entry = NULL;
+
+    pthread_mutex_unlock(&g_cache_lock);
+
+    return entry;
+}
+
+/* Make entries under path be checked against the files again.
+ * Path may be a file or a directory
+ */
+static void cache_invalidate(const unsigned char *path) {
+
+    size_t i, len = strlen(path);
+    struct cache_entry *entry;
+    const unsigned char *entry_path;
+
+    pthread_mutex_lock(&g_cache_lock);
+
+    for (i = 0; i < g_cache_size; i++)
+	for (entry = g_cache[i]; entry != NULL; entry = entry->next) {
+	    entry_path = cache_record_path(entry->rec);
+	    if (!entry->symdb && !strncmp(entry_path, path, len) && (entry_path[len] == '\0' || entry_path[len] == '/'))
+		entry->verified = 0;
+	}
+
+    pthread_mutex_unlock(&g_cache_lock);
+}
+
+static int cmp_export(const void *a, const void *b) {
+
+    const struct cache_export *x = a, *y = b;
+
+    if (x->hash != y->hash)
+	return x->hash < y->hash ? -1 : 1;
+
+    return strcmp(x->name, y->name);
+}
+
+/* Build record from parsed object and put it in index */
+static struct cache_entry* cache_store(const unsigned char *path, const struct elf_image *image,
+		    const struct elf_object *obj, const unsigned char *build_id, uint8_t build_id_len)
+{
+    size_t i, n, needed_cnt = 0, import_cnt = 0, export_cnt = 0, strings_size = 0, size;
+    struct cache_export *exports;
+    struct cache_record *rec;
+    struct cache_entry *entry;
+    unsigned char *p;
+    uint32_t *hashes;
+
+    exports = (struct cache_export *)malloc((obj->sym_cnt + 1) * sizeof(struct cache_export));
+    if (exports == NULL)
+	return NULL;
+
+    /* Count sizes first */
+    if (g_elf_class == ELFCLASS32)
+	export_cnt = scan_symbols32(obj, exports, &needed_cnt, &import_cnt, &strings_size);
+    else
+	export_cnt = scan_symbols64(obj, exports, &needed_cnt, &import_cnt, &strings_size);
+
+    /* Sort by hash and drop duplicates (versioned symbols) */
+    qsort(exports, export_cnt, sizeof(struct cache_export), cmp_export);
+    for (i = 0, n = 0; i < export_cnt; i++)
+	if (n == 0 || cmp_export(&exports[n - 1], &exports[i]))
+	    exports[n++] = exports[i];
+    export_cnt = n;
+    for (i = 0; i < export_cnt; i++)
+	strings_size += strlen(exports[i].name) + 1;
+
+    size = sizeof(struct cache_record) + export_cnt * sizeof(uint32_t) + build_id_len
+	    + strlen(path) + 1 + strings_size;
+    size = (size + 7) & ~(size_t)7;
+    rec = (struct cache_record *)calloc(1, size);
+    if (rec == NULL) {
+	free(exports);
+	return NULL;
+    }
+
+    rec->size = image->size;
+    rec->mtime_sec = image->mtime.tv_sec;
+    rec->mtime_nsec = image->mtime.tv_nsec;
+    rec->record_size = size;
+    rec->needed_cnt = needed_cnt;
+    rec->import_cnt = import_cnt;
+    rec->export_cnt = export_cnt;
+    rec->path_len = strlen(path) + 1;
+    rec->build_id_len = build_id_len;
+    rec->elf_class = g_elf_class;
+    rec->strings_size = strings_size;
+
+    hashes = (uint32_t *)(rec + 1);
+    for (i = 0; i < export_cnt; i++)
+	hashes[i] = exports[i].hash;
+
+    p = (unsigned char *)(hashes + export_cnt);
+    if (build_id_len != 0)
+	memcpy(p, build_id, build_id_len);
+    p += build_id_len;
+    memcpy(p, path, rec->path_len);
+    p += rec->path_len;
+
+    /* Strings: needed libs, imports, exports */
+    if (g_elf_class == ELFCLASS32)
+	p = copy_strings32(obj, p);
+    else
+	p = copy_strings64(obj, p);
+    for (i = 0; i < export_cnt; i++)
+	p = stpcpy(p, exports[i].name) + 1;
+    free(exports);
+
+    pthread_mutex_lock(&g_cache_lock);
+
+    /* Lib could be indexed by another worker meanwhile */
+    for (entry = g_cache_size ? g_cache[gnu_hash(path) & (g_cache_size - 1)] : NULL; entry != NULL; entry = entry->next)
+	if (!strcmp(cache_record_path(entry->rec), path))
+	    break;
+    if (entry != NULL && entry->verified) {
+	free(rec);
+	goto exit;
+    }
+
+    entry = cache_insert(rec, 1);
+    if (entry == NULL) {
+	free(rec);
+	goto exit;
+    }
+    g_cache_dirty = 1;
+
+    if (cache_decode(entry) < 0)
+	entry = NULL;
+    else
+	entry->verified = 1;
+
+exit:
+    pthread_mutex_unlock(&g_cache_lock);
+
+    return entry;
+}
+
+/* Binary search over export hashes of cached lib */
+static int cache_has_export(const struct cache_entry *entry, const unsigned char *symbol, uint32_t hash) {
+
+    const uint32_t *hashes = cache_record_hashes(entry->rec);
+    size_t lo = 0, hi = entry->rec->export_cnt, mid;
+    uint64_t mask = ((uint64_t)1 << (hash % 64)) | ((uint64_t)1 << ((hash >> BLOOM_SHIFT) % 64));
+
+    /* Skip lib which surely doesn't export symbol */
+    if ((entry->bloom[(hash / 64) & entry->bloom_mask] & mask) != mask) {
+	STAT_ADD(g_stat_bloom, 1);
+	return 0;
+    }
+
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (hashes[mid] < hash)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    for (; lo < entry->rec->export_cnt && hashes[lo] == hash; lo++) {
+	STAT_ADD(g_stat_strcmp, 1);
+	if (!strcmp(entry->exports[lo], symbol))
+	    return 1;
+    }
+
+    return 0;
+}
+
+static const struct global_export* find_export(const unsigned char *symbol, uint32_t hash) {
+
+    struct global_export *val;
+
+    if (g_exports == NULL)
+	return NULL;
+
+    for (val = g_exports[hash & (g_exports_size - 1)]; val != NULL; val = val->next)
+	if (val->hash == hash) {
+	    STAT_ADD(g_stat_strcmp, 1);
+	    if (!strcmp(val->name, symbol))
+		return val;
+	}
+
+    return NULL;
+}
+
+/* Merge exports of lib into global index, libs are added in load order
+ * so symbol keeps the provider the linker would bind it to
+ */
+static void add_exports(const struct cache_entry *entry, uint32_t lib_id) {
+
+    size_t i, k, size;
+    const uint32_t *hashes = cache_record_hashes(entry->rec);
+    struct global_export *val, **table;
+
+    for (i = 0; i < entry->rec->export_cnt; i++) {
+	if (find_export(entry->exports[i], hashes[i]) != NULL)
+	    continue;
+
+	if (g_exports_cnt >= g_exports_size) {
+	    size = g_exports_size ? g_exports_size * 2 : 4096;
+	    table = (struct global_export **)calloc(size, sizeof(struct global_export *));
+	    if (table == NULL)
+		return;
+	    for (k = 0; k < g_exports_size; k++)
+		while ((val = g_exports[k]) != NULL) {
+		    g_exports[k] = val->next;
+		    val->next = table[val->hash & (size - 1)];
+		    table[val->hash & (size - 1)] = val;
+		}
+	    free(g_exports);
+	    g_exports = table;
+	    g_exports_size = size;
+	}
+
+	val = (struct global_export *)arena_alloc(sizeof(struct global_export));
+	if (val == NULL)
+	    return;
+	val->hash = hashes[i];
+	val->lib_id = lib_id;
+	val->name = entry->exports[i];
+	val->next = g_exports[hashes[i] & (g_exports_size - 1)];
+	g_exports[hashes[i] & (g_exports_size - 1)] = val;
+	g_exports_cnt++;
+    }
+}
+
+/* Locate dynamic symbols of mapped object.
+ * Returns -ENOENT if object has neither PT_DYNAMIC segment nor .dynamic section
+ */
+static int parse_object(const struct elf_image *image, struct elf_object *obj, const char **error) {
+
+    union Elf_Shdr dynamic, dynsym, dynstr;
+    int ret;
+
+    ret = read_header(image, &obj->header);
+    if (ret < 0) {
+	*error = "Error occured while reading ELF header";
+	return ret;
+    }
+
+    obj->program_table = read_program_table(image, &obj->header);
+    obj->section_table = read_section_table(image, &obj->header);
+
+    /* Loader only needs program headers, sections are the fallback */
+    if (g_elf_class == ELFCLASS32)
+	ret = parse_dynamic32(image, obj, error);
+    else
+	ret = parse_dynamic64(image, obj, error);
+    if (ret != -ENOENT)
+	return ret;
+
+    if (obj->section_table.raw == NULL) {
+	if (obj->program_table.raw != NULL) {
+	    *error = "Error occured while reading .dynamic segment header";
+	    return -ENOENT;
+	}
+	*error = "Error occured while reading section table";
+	return -EFAULT;
+    }
+
+    dynamic = section_by_type(&obj->header, SHT_DYNAMIC, obj->section_table);
+    if (dynamic.raw == NULL) {
+	*error = "Error occured while reading .dynamic section header";
+	return -ENOENT;
+    }
+
+    obj->dynamic_table = read_dynamic_table(image, dynamic);
+    if (obj->dynamic_table.raw == NULL) {
+	*error = "Error occured while reading table for section .dynamic";
+	return -EFAULT;
+    }
+
+    dynsym = section_by_type(&obj->header, SHT_DYNSYM, obj->section_table);
+    if (dynsym.raw == NULL) {
+	*error = "Error occured while reading .dynsym section header";
+	return -EFAULT;
+    }
+
+    obj->symbol_table = read_symbol_table(image, dynsym);
+    if (obj->symbol_table.raw == NULL) {
+	*error = "Error occured while reading table for section .dynsym";
+	return -EFAULT;
+    }
+
+    if (g_elf_class == ELFCLASS32) {
+	obj->dyn_cnt = dynamic.Shdr32->sh_size / sizeof(Elf32_Dyn);
+	obj->sym_cnt = dynsym.Shdr32->sh_size / sizeof(Elf32_Sym);
+	dynstr = section_by_index(&obj->header, dynsym.Shdr32->sh_link, obj->section_table);
+    }
+    else {
+	obj->dyn_cnt = dynamic.Shdr64->sh_size / sizeof(Elf64_Dyn);
+	obj->sym_cnt = dynsym.Shdr64->sh_size / sizeof(Elf64_Sym);
+	dynstr = section_by_index(&obj->header, dynsym.Shdr64->sh_link, obj->section_table);
+    }
+    if (dynstr.raw == NULL) {
+	*error = "Error occured while reading table for section .dynsym";
+	return -EFAULT;
+    }
+
+    if (read_string_table(image, dynstr, &obj->string_table) < 0) {
+	*error = "Error occured while reading table for section .strtab";
+	return -EFAULT;
+    }
+
+    return 0;
+}
+
+static void lib_index_add(int k, const unsigned char *dir, const unsigned char *name) {
+
+    size_t i, size;
+    uint32_t hash = gnu_hash(name);
+    struct lib_entry *entry, **table;
+
+    /* Directory which comes first in search order wins */
+    if (g_lib_index_size[k])
+	for (entry = g_lib_index[k][hash & (g_lib_index_size[k] - 1)]; entry != NULL; entry = entry->next)
+	    if (entry->hash == hash && !strcmp(entry->name, name))
+		return;
+
+    if (g_lib_index_cnt[k] >= g_lib_index_size[k]) {
+	size = g_lib_index_size[k] ? g_lib_index_size[k] * 2 : 512;
+	table = (struct lib_entry **)calloc(size, sizeof(struct lib_entry *));
+	if (table == NULL)
+	    return;
+	for (i = 0; i < g_lib_index_size[k]; i++)
+	    while ((entry = g_lib_index[k][i]) != NULL) {
+		g_lib_index[k][i] = entry->next;
+		entry->next = table[entry->hash & (size - 1)];
+		table[entry->hash & (size - 1)] = entry;
+	    }
+	free(g_lib_index[k]);
+	g_lib_index[k] = table;
+	g_lib_index_size[k] = size;
+    }
+
+    entry = (struct lib_entry *)malloc(sizeof(struct lib_entry));
+    if (entry == NULL)
+	return;
+    entry->path = (unsigned char *)malloc(strlen(dir) + strlen(name) + 2);
+    if (entry->path == NULL) {
+	free(entry);
+	return;
+    }
+    sprintf(entry->path, "%s/%s", dir, name);
+    entry->name = entry->path + strlen(dir) + 1;
+    entry->hash = hash;
+    entry->next = g_lib_index[k][hash & (g_lib_index_size[k] - 1)];
+    g_lib_index[k][hash & (g_lib_index_size[k] - 1)] = entry;
+    g_lib_index_cnt[k]++;
+}
+
+static void lib_index_free(void) {
+
+    int k;
+    size_t i;
+    struct lib_entry *entry;
+
+    for (k = 0; k < 2; k++) {
+	for (i = 0; i < g_lib_index_size[k]; i++)
+	    while ((entry = g_lib_index[k][i]) != NULL) {
+		g_lib_index[k][i] = entry->next;
+		free(entry->path);
+		free(entry);
+	    }
+	g_lib_index_cnt[k] = 0;
+    }
+
+    free(g_lib_index_key);
+    g_lib_index_key = NULL;
+    g_lib_index_gen++;
+}
+
+/* Drop records of symdb from export index */
+static void symdb_close(void) {
+
+    size_t i;
+    struct cache_entry *entry, **prev;
+
+    for (i = 0; i < g_cache_size; i++)
+	for (prev = &g_cache[i]; (entry = *prev) != NULL; )
+	    if (entry->symdb) {
+		*prev = entry->next;
+		if (entry->owned)
+		    free((void *)entry->rec);
+		free(entry->strings);
+		free(entry);
+		g_cache_cnt--;
+	    }
+	    else
+		prev = &entry->next;
+
+    if (g_symdb_map == NULL)
+	return;
+
+    munmap((void *)g_symdb_map, g_symdb_map_size);
+    g_symdb_map = NULL;
+    g_symdb_libs = NULL;
+    g_symdb_cnt = 0;
+    g_symdb_path[0] = '\0';
+
+    /* Providers of --suggest point to records of symdb */
+    lib_index_free();
+}
+
+/* Symbol database of ROM build.
+ * File consists of "SYMDEPD2" magic, number of shared objects and their
+ * soname table, followed by records of export index for shared objects
+ * of ROM, path of record is the path of object inside ROM. File is only
+ * mapped: needed lib is looked up in soname table by binary search,
+ * its record is checked and put into export index on first use
+ */
+static int symdb_open(void) {
+
+    int fd;
+    struct stat st;
+    void *map;
+    uint64_t cnt;
+
+    if (g_symdb == NULL) {
+	symdb_close();
+	return 0;
+    }
+
+    fd = open(g_symdb, O_RDONLY);
+    if (fd < 0)
+	return -errno;
+    if (fstat(fd, &st) < 0) {
+	close(fd);
+	return -errno;
+    }
+
+    /* Daemon keeps symdb mapped while file stays the same */
+    if (g_symdb_map != NULL && !strcmp(g_symdb_path, g_symdb) && g_symdb_map_size == (size_t)st.st_size
+	&& g_symdb_mtime.tv_sec == st.st_mtim.tv_sec && g_symdb_mtime.tv_nsec == st.st_mtim.tv_nsec) {
+	    close(fd);
+	    return 0;
+    }
+    symdb_close();
+
+    if ((size_t)st.st_size < CACHE_MAGIC_SIZE + sizeof(uint64_t)) {
+	close(fd);
+	return -EINVAL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+	return -errno;
+    cnt = *(const uint64_t *)((const unsigned char *)map + CACHE_MAGIC_SIZE);
+    if (memcmp(map, SYMDB_MAGIC, CACHE_MAGIC_SIZE)
+	|| cnt > (st.st_size - CACHE_MAGIC_SIZE - sizeof(uint64_t)) / sizeof(struct symdb_lib)) {
+	    munmap(map, st.st_size);
+	    return -EINVAL;
+    }
+
+    g_symdb_map = map;
+    g_symdb_map_size = st.st_size;
+    g_symdb_mtime = st.st_mtim;
+    g_symdb_libs = (const struct symdb_lib *)(g_symdb_map + CACHE_MAGIC_SIZE + sizeof(uint64_t));
+    g_symdb_cnt = cnt;
+    snprintf(g_symdb_path, PATH_MAX, "%s", g_symdb);
+
+    return 0;
+}
+
+/* Compare entry of soname table with ELF class and file name,
+ * name of broken entry is bounded by the end of symdb
+ */
+static int symdb_cmp(size_t i, uint8_t elf_class, const unsigned char *name) {
+
+    uint64_t offset = g_symdb_libs[i].name;
+
+    if (g_symdb_libs[i].elf_class != elf_class)
+	return g_symdb_libs[i].elf_class < elf_class ? -1 : 1;
+    if (offset >= g_symdb_map_size)
+	return 1;
+
+    return strncmp(g_symdb_map + offset, name, g_symdb_map_size - offset);
+}
+
+/* Returns record of entry of soname table,
+ * record has to lie in symdb and end with file name of the entry
+ */
+static const struct cache_record* symdb_record(size_t i) {
+
+    uint64_t offset = g_symdb_libs[i].record;
+    const struct cache_record *rec;
+    const unsigned char *slash;
+
+    if (offset % 8 || g_symdb_map_size < sizeof(struct cache_record)
+	|| offset > g_symdb_map_size - sizeof(struct cache_record))
+	    return NULL;
+    rec = (const struct cache_record *)(g_symdb_map + offset);
+    if (rec->record_size < sizeof(struct cache_record) || rec->record_size > g_symdb_map_size - offset
+	|| !cache_record_valid(rec) || rec->elf_class != g_symdb_libs[i].elf_class)
+	    return NULL;
+    slash = (const unsigned char *)strrchr(cache_record_path(rec), '/');
+    if (slash == NULL || g_symdb_libs[i].name != (uint64_t)(slash + 1 - g_symdb_map))
+	return NULL;
+
+    return rec;
+}
+
+/* Returns record of the first lib with name in search order */
+static const struct cache_record* symdb_find(uint8_t elf_class, const unsigned char *name) {
+
+    size_t lo = 0, hi = g_symdb_cnt, mid;
+
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (symdb_cmp(mid, elf_class, name) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo == g_symdb_cnt || symdb_cmp(lo, elf_class, name))
+	return NULL;
+
+    return symdb_record(lo);
+}
+
+/* Look for lib in symdb, its record is put into export index */
+static int symdb_lookup(const unsigned char *libname, unsigned char *full_path) {
+
+    const struct cache_record *rec;
+    struct cache_entry *entry;
+    const unsigned char *path;
+
+    if (g_symdb_map == NULL || (rec = symdb_find(g_elf_class, libname)) == NULL)
+	return -ENOENT;
+    path = cache_record_path(rec);
+
+    pthread_mutex_lock(&g_cache_lock);
+    entry = g_cache_size ? g_cache[gnu_hash(path) & (g_cache_size - 1)] : NULL;
+    for (; entry != NULL; entry = entry->next)
+	if (!strcmp(cache_record_path(entry->rec), path))
+	    break;
+    if (entry == NULL || entry->rec != rec) {
+	entry = cache_insert(rec, 0);
+	if (entry != NULL) {
+	    entry->verified = 1;
+	    entry->symdb = 1;
+	}
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+
+    if (entry == NULL)
+	return -ENOMEM;
+    strcpy(full_path, path);
+
+    return 0;
+}
+
+static int index_dir_entry(void *arg, const unsigned char *name, uint8_t type) {
+
+    size_t i = *(size_t *)arg;
+    const unsigned char *dir_name = basename(g_paths[i]);
+
+    if (name[0] == '.' || type == DT_DIR)
+	return 0;
+    if (i < g_cust_path || !strcmp(dir_name, "lib"))
+	lib_index_add(0, g_paths[i], name);
+    if (i < g_cust_path || !strcmp(dir_name, "lib64"))
+	lib_index_add(1, g_paths[i], name);
+
+    return 0;
+}
+
+/* List search directories once, so that looking for lib needs no syscalls.
+ * Index is kept while search directories stay the same
+ */
+static void index_search_dirs(void) {
+
+    size_t i, len = strlen(g_symdb_path) + 1;
+    unsigned char *key, *dir_name;
+
+    for (i = 0; i < g_path_cnt; i++)
+	len += strlen(g_paths[i]) + 1;
+    key = (unsigned char *)malloc(len + 24);
+    if (key == NULL)
+	return;
+    len = sprintf(key, "%zu\n%s\n", g_cust_path, g_symdb_path);
+    for (i = 0; i < g_path_cnt; i++)
+	len += sprintf(key + len, "%s\n", g_paths[i]);
+
+    if (g_lib_index_key != NULL && !strcmp(g_lib_index_key, key)) {
+	free(key);
+	return;
+    }
+
+    lib_index_free();
+    g_lib_index_key = key;
+
+    for (i = 0; i < g_path_cnt; i++) {
+	dir_name = basename(g_paths[i]);
+	/* Look for lib in provided custom directories
+	 * and appropriate to ELF class directories
+	 */
+	if (i >= g_cust_path && strcmp(dir_name, "lib") && strcmp(dir_name, "lib64"))
+	    continue;
+
+	list_dir(g_paths[i], index_dir_entry, &i);
+    }
+}
+
+static int find_lib(const unsigned char *libname, unsigned char *full_path) {
+
+    int k = g_elf_class == ELFCLASS32 ? 0 : 1, ret;
+    uint32_t hash = gnu_hash(libname);
+    struct lib_entry *entry;
+
+    if (g_lib_index_size[k])
+	for (entry = g_lib_index[k][hash & (g_lib_index_size[k] - 1)]; entry != NULL; entry = entry->next)
+	    if (entry->hash == hash && !strcmp(entry->name, libname)) {
+		strcpy(full_path, entry->path);
+		return 0;
+	    }
+
+    /* Objects of symdb come after custom directories */
+    if ((ret = symdb_lookup(libname, full_path)) == 0)
+	return 0;
+
+    errno = -ret;
+    return -1;
+}
+
+/* Returns index of the first shim of lib or -1 */
+static inline int has_shim(const unsigned char *libname) {
+
+    int i;
+    uint32_t hash;
+
+    if (g_shim_index_size == 0)
+	return -1;
+
+    hash = gnu_hash(libname);
+    for (i = g_shim_index[hash & (g_shim_index_size - 1)]; i >= 0; i = g_shimlibs[i].next)
+	if (g_shimlibs[i].hash == hash && !strcmp(libname, g_shimlibs[i].lib))
+	    return i;
+
+    return -1;
+}
+
+/* Returns index of the next shim of the same lib or -1 */
+static inline int next_shim(int i) {
+
+    int k;
+
+    for (k = g_shimlibs[i].next; k >= 0; k = g_shimlibs[k].next)
+	if (g_shimlibs[k].hash == g_shimlibs[i].hash && !strcmp(g_shimlibs[k].lib, g_shimlibs[i].lib))
+	    return k;
+
+    return -1;
+}
+
+/* Index shims once options are parsed, lookups are read-only afterwards */
+static int index_shims(void) {
+
+    size_t i, k, size = 16;
+    int *index;
+
+    if (g_shim_cnt == 0) {
+	g_shim_index_size = 0;
+	return 0;
+    }
+
+    while (size < g_shim_cnt * 2)
+	size *= 2;
+    if (size != g_shim_index_size) {
+	index = (int *)realloc(g_shim_index, size * sizeof(int));
+	if (index == NULL) {
+	    g_shim_index_size = 0;
+	    return -ENOMEM;
+	}
+	g_shim_index = index;
+	g_shim_index_size = size;
+    }
+    memset(g_shim_index, 0xff, size * sizeof(int));
+
+    /* Backwards, so that shims of a lib keep their order */
+    for (i = g_shim_cnt; i-- > 0;) {
+	k = g_shimlibs[i].hash & (size - 1);
+	g_shimlibs[i].next = g_shim_index[k];
+	g_shim_index[k] = i;
+    }
+
+    return 0;
+}
+
+static void stats_start(struct stats_time *t) {
+
+    if (!g_stats)
+	return;
+
+    clock_gettime(CLOCK_MONOTONIC, &t->wall);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t->cpu);
+}
+
+static inline double elapsed(const struct timespec *from, const struct timespec *to) {
+
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/* Account time since t to phase and start over */
+static void stats_phase(int phase, struct stats_time *t) {
+
+    struct stats_time now;
+
+    if (!g_stats)
+	return;
+
+    stats_start(&now);
+    g_phase_wall[phase] += elapsed(&t->wall, &now.wall);
+    g_phase_cpu[phase] += elapsed(&t->cpu, &now.cpu);
+    *t = now;
+}
+
+static void stats_lib(const unsigned char *path, const struct stats_time *start,
+					size_t imports, size_t lookups)
+{
+    uint32_t hash;
+    struct lib_stats *lib;
+    struct stats_time now;
+
+    if (!g_stats)
+	return;
+
+    hash = gnu_hash(path);
+    for (lib = g_lib_stats[hash % ARRAY_SIZE(g_lib_stats)]; lib != NULL; lib = lib->next)
+	if (lib->hash == hash && !strcmp(lib->path, path))
+	    break;
+
+    if (lib == NULL) {
+	lib = (struct lib_stats *)calloc(1, sizeof(struct lib_stats));
+	if (lib == NULL || (lib->path = strdup(path)) == NULL) {
+	    free(lib);
+	    return;
+	}
+	lib->hash = hash;
+	lib->next = g_lib_stats[hash % ARRAY_SIZE(g_lib_stats)];
+	g_lib_stats[hash % ARRAY_SIZE(g_lib_stats)] = lib;
+	g_lib_stats_cnt++;
+    }
+
+    stats_start(&now);
+    lib->wall += elapsed(&start->wall, &now.wall);
+    lib->visits++;
+    lib->imports += imports;
+    lib->lookups += lookups;
+}
+
+static void stats_reset(void) {
+
+    size_t i;
+    struct lib_stats *lib;
+
+    memset(g_phase_wall, 0, sizeof(g_phase_wall));
+    memset(g_phase_cpu, 0, sizeof(g_phase_cpu));
+    g_stat_syscalls = g_stat_mapped = g_stat_opened = g_stat_parsed = 0;
+    g_stat_reused = g_stat_inserted = g_stat_strcmp = g_stat_bloom = 0;
+
+    for (i = 0; i < ARRAY_SIZE(g_lib_stats); i++)
+	while ((lib = g_lib_stats[i]) != NULL) {
+	    g_lib_stats[i] = lib->next;
+	    free(lib->path);
+	    free(lib);
+	}
+    g_lib_stats_cnt = 0;
+}
+
+static int cmp_lib_stats(const void *a, const void *b) {
+
+    const struct lib_stats *x = *(const struct lib_stats **)a, *y = *(const struct lib_stats **)b;
+
+    return x->wall < y->wall ? 1 : x->wall > y->wall ? -1 : 0;
+}
+
+/* Print report of --stats to stderr, so that it doesn't mix with results.
+ * Daemon sends it to the client along with results
+ */
+static void stats_report(const struct stats_time *start) {
+
+    static const char * const phases[PHASE_CNT] = {
+	"prefetch", "path probing", "open and map", "parse and index", "imports", "resolution"
+    };
+    size_t i, n = 0;
+    struct stats_time now;
+    struct rusage ru;
+    struct lib_stats *lib, **libs;
+    FILE *out = g_serving ? stdout : stderr;
+
+    stats_start(&now);
+    getrusage(RUSAGE_SELF, &ru);
+
+    fprintf(out, "\nStatistics:\n");
+    fprintf(out, "%-20s %12s %12s\n", "phase", "wall, s", "cpu, s");
+    for (i = 0; i < PHASE_CNT; i++)
+	fprintf(out, "%-20s %12.6f %12.6f\n", phases[i], g_phase_wall[i], g_phase_cpu[i]);
+    fprintf(out, "%-20s %12.6f %12.6f\n", "total", elapsed(&start->wall, &now.wall),
+	    elapsed(&start->cpu, &now.cpu));
+
+    fprintf(out, "%-20s %12zu\n", "syscalls", g_stat_syscalls);
+    fprintf(out, "%-20s %12zu\n", "bytes mapped", g_stat_mapped);
+    fprintf(out, "%-20s %12llu\n", "bytes read", (unsigned long long)ru.ru_inblock * 512);
+    fprintf(out, "%-20s %12ld\n", "major page faults", ru.ru_majflt);
+    fprintf(out, "%-20s %12ld\n", "minor page faults", ru.ru_minflt);
+    fprintf(out, "%-20s %12zu\n", "libs opened", g_stat_opened);
+    fprintf(out, "%-20s %12zu\n", "libs parsed", g_stat_parsed);
+    fprintf(out, "%-20s %12zu\n", "libs from index", g_stat_reused);
+    fprintf(out, "%-20s %12zu\n", "symbols inserted", g_stat_inserted);
+    fprintf(out, "%-20s %12zu\n", "string compares", g_stat_strcmp);
+    fprintf(out, "%-20s %12zu\n", "bloom rejects", g_stat_bloom);
+
+    libs = (struct lib_stats **)malloc((g_lib_stats_cnt + 1) * sizeof(struct lib_stats *));
+    if (libs == NULL)
+	return;
+    for (i = 0; i < ARRAY_SIZE(g_lib_stats); i++)
+	for (lib = g_lib_stats[i]; lib != NULL; lib = lib->next)
+	    libs[n++] = lib;
+    qsort(libs, n, sizeof(struct lib_stats *), cmp_lib_stats);
+
+    fprintf(out, "\n%12s %8s %10s %10s  %s\n", "wall, ms", "visits", "imports", "lookups", "lib");
+    for (i = 0; i < n; i++)
+	fprintf(out, "%12.3f %8zu %10zu %10zu  %s\n", libs[i]->wall * 1000, libs[i]->visits,
+		libs[i]->imports, libs[i]->lookups, libs[i]->path);
+    free(libs);
+}
+
+/* Parse lib into export index without any output.
+ * Class is taken from the file if g_elf_class is ELFCLASSNONE
+ */
+static struct cache_entry* index_lib(const unsigned char *path) {
+
+    struct elf_image image;
+    struct elf_object obj;
+    struct cache_entry *entry = NULL;
+    const unsigned char *build_id;
+    uint8_t build_id_len;
+    const char *error;
+
+    /* Lib unchanged since it was indexed is not parsed again */
+    if ((entry = cache_probe(path, g_elf_class == ELFCLASSNONE)) != NULL) {
+	STAT_ADD(g_stat_reused, 1);
+	return entry;
+    }
+
+    if (open_image(path, &image) < 0)
+	return NULL;
+    STAT_ADD(g_stat_opened, 1);
+
+    if (g_elf_class == ELFCLASSNONE && (image.base[EI_CLASS] == ELFCLASS32 || image.base[EI_CLASS] == ELFCLASS64))
+	g_elf_class = image.base[EI_CLASS];
+
+    if (!strncmp(image.base, ELFMAG, SELFMAG) && image.base[EI_CLASS] == g_elf_class
+	&& image.base[EI_DATA] == ELFDATA2LSB && !parse_object(&image, &obj, &error)) {
+	    STAT_ADD(g_stat_parsed, 1);
+	    read_build_id(&image, &obj, &build_id, &build_id_len);
+	    entry = cache_lookup(path, &image, build_id, build_id_len);
+	    if (entry == NULL)
+		entry = cache_store(path, &image, &obj, build_id, build_id_len);
+    }
+
+    unmap_image(&image);
+    return entry;
+}
+
+static void prefetch_push(struct prefetch_queue *queue, const struct prefetch_task *task) {
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->tail == queue->size) {
+	if (queue->head > 0) {
+	    memmove(queue->tasks, queue->tasks + queue->head, (queue->tail - queue->head) * sizeof(struct prefetch_task));
+	    queue->tail -= queue->head;
+	    queue->head = 0;
+	}
+	else {
+	    size_t size = queue->size ? queue->size * 2 : 64;
+	    struct prefetch_task *tasks = (struct prefetch_task *)realloc(queue->tasks, size * sizeof(struct prefetch_task));
+	    if (tasks == NULL) {
+		pthread_mutex_unlock(&queue->lock);
+		return;
+	    }
+	    queue->tasks = tasks;
+	    queue->size = size;
+	}
+    }
+    queue->tasks[queue->tail++] = *task;
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* Owner takes the newest task, thieves take the oldest one */
+static int prefetch_pop(struct prefetch_queue *queue, struct prefetch_task *task, uint8_t steal) {
+
+    int ret = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail > queue->head) {
+	*task = steal ? queue->tasks[queue->head++] : queue->tasks[--queue->tail];
+	ret = 1;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return ret;
+}
+
+/* Queue lib unless it was already queued at the same or lower depth */
+static void prefetch_schedule(unsigned int worker, const unsigned char *name, uint32_t depth, uint8_t elf_class) {
+
+    struct prefetch_claim *claim;
+    struct prefetch_task task;
+    size_t i = gnu_hash(name) % ARRAY_SIZE(g_claims);
+
+    pthread_mutex_lock(&g_pool_lock);
+
+    for (claim = g_claims[i]; claim != NULL; claim = claim->next)
+	if (claim->elf_class == elf_class && !strcmp(claim->name, name))
+	    break;
+
+    if (claim != NULL && claim->depth <= depth) {
+	pthread_mutex_unlock(&g_pool_lock);
+	return;
+    }
+
+    if (claim == NULL) {
+	claim = (struct prefetch_claim *)malloc(sizeof(struct prefetch_claim));
+	if (claim == NULL || (claim->name = strdup(name)) == NULL) {
+	    free(claim);
+	    pthread_mutex_unlock(&g_pool_lock);
+	    return;
+	}
+	claim->elf_class = elf_class;
+	claim->next = g_claims[i];
+	g_claims[i] = claim;
+    }
+    claim->depth = depth;
+
+    task.name = claim->name;
+    task.depth = depth;
+    task.elf_class = elf_class;
+    g_pending++;
+    g_pool_gen++;
+    pthread_cond_broadcast(&g_pool_cond);
+
+    pthread_mutex_unlock(&g_pool_lock);
+
+    prefetch_push(&g_queues[worker], &task);
+}
+
+static void prefetch_lib(unsigned int worker, const struct prefetch_task *task) {
+
+    int i;
+    uint32_t j;
+    struct cache_entry *entry;
+    unsigned char path[PATH_MAX];
+
+    g_elf_class = task->elf_class;
+
+    if (task->depth == 0)
+	snprintf(path, PATH_MAX, "%s", task->name);
+    else if (find_lib(task->name, path) < 0)
+	return;
+
+    entry = cache_find(path);
+    if (entry == NULL)
+	entry = index_lib(path);
+    if (entry == NULL)
+	return;
+
+    /* Shim lib is processed at the same level as its counterpart */
+    if (task->depth > 0)
+	for (i = has_shim(task->name); i >= 0; i = next_shim(i))
+	    prefetch_schedule(worker, g_shimlibs[i].shim, task->depth, task->elf_class);
+
+    if (g_full || g_global || task->depth < g_depth)
+	for (j = 0; j < entry->rec->needed_cnt; j++)
+	    prefetch_schedule(worker, entry->needed[j], task->depth + 1, task->elf_class);
+}
+
+static void* prefetch_worker(void *arg) {
+
+    unsigned int i, worker = (uintptr_t)arg;
+    struct prefetch_task task;
+    uint64_t gen;
+    uint8_t done, found;
+
+    for (;;) {
+	pthread_mutex_lock(&g_pool_lock);
+	gen = g_pool_gen;
+	pthread_mutex_unlock(&g_pool_lock);
+
+	/* Own queue first, then steal from others */
+	found = prefetch_pop(&g_queues[worker], &task, 0);
+	for (i = 1; !found && i < g_jobs; i++)
+	    found = prefetch_pop(&g_queues[(worker + i) % g_jobs], &task, 1);
+
+	if (found) {
+	    prefetch_lib(worker, &task);
+	    pthread_mutex_lock(&g_pool_lock);
+	    if (--g_pending == 0)
+		pthread_cond_broadcast(&g_pool_cond);
+	    pthread_mutex_unlock(&g_pool_lock);
+	    continue;
+	}
+
+	/* Nothing to do, wait for new tasks or completion */
+	pthread_mutex_lock(&g_pool_lock);
+	while (g_pending != 0 && g_pool_gen == gen)
+	    pthread_cond_wait(&g_pool_cond, &g_pool_lock);
+	done = g_pending == 0;
+	pthread_mutex_unlock(&g_pool_lock);
+	if (done)
+	    break;
+    }
+
+    return NULL;
+}
+
+/* Parse dependency graphs of targets on g_jobs threads,
+ * so that process_lib finds every lib in export index
+ */
+static void prefetch(unsigned char * const *targets, size_t target_cnt) {
+
+    unsigned int i;
+    size_t k;
+    unsigned char ident[EI_NIDENT];
+    struct prefetch_claim *claim;
+    pthread_t *threads;
+
+    if (g_jobs < 2)
+	return;
+
+    /* Daemon may be asked for more threads than before */
+    if (g_queue_cnt < g_jobs) {
+	for (i = 0; i < g_queue_cnt; i++) {
+	    pthread_mutex_destroy(&g_queues[i].lock);
+	    free(g_queues[i].tasks);
+	}
+	free(g_queues);
+	g_queue_cnt = 0;
+	g_queues = (struct prefetch_queue *)calloc(g_jobs, sizeof(struct prefetch_queue));
+	if (g_queues == NULL)
+	    return;
+	for (i = 0; i < g_jobs; i++)
+	    pthread_mutex_init(&g_queues[i].lock, NULL);
+	g_queue_cnt = g_jobs;
+    }
+
+    /* Spread targets over queues, workers will balance them anyway */
+    for (k = 0; k < target_cnt; k++) {
+	if (!read_ident(targets[k], ident) && !strncmp(ident, ELFMAG, SELFMAG)
+	    && (ident[EI_CLASS] == ELFCLASS32 || ident[EI_CLASS] == ELFCLASS64))
+		prefetch_schedule(k % g_jobs, targets[k], 0, ident[EI_CLASS]);
+    }
+
+    threads = (pthread_t *)calloc(g_jobs, sizeof(pthread_t));
+    if (threads == NULL)
+	return;
+
+    for (i = 1; i < g_jobs; i++)
+	if (pthread_create(&threads[i], NULL, prefetch_worker, (void *)(uintptr_t)i))
+	    break;
+    prefetch_worker((void *)0);
+    while (--i > 0)
+	pthread_join(threads[i], NULL);
+    free(threads);
+
+    /* Claims are per prefetch */
+    for (k = 0; k < ARRAY_SIZE(g_claims); k++)
+	while ((claim = g_claims[k]) != NULL) {
+	    g_claims[k] = claim->next;
+	    free(claim->name);
+	    free(claim);
+	}
+}
+
+/* Walks over tables of lib being processed, instantiated per ELF class */
+#define ELF_LIB_FUNCTIONS(bits)								\
+/* Fill in list of symbols required by lib */						\
+static void add_imports##bits(const struct elf_object *obj, uint32_t id) {		\
+											\
+    size_t i;										\
+    const unsigned char *name;								\
+											\
+    for (i = 0; i < obj->sym_cnt; i++)							\
+	if (symbol_is_import##bits(obj, i) && (name = symbol_name##bits(obj, i)) != NULL && *name != '\0') \
+	    add_in_sym_list(name, id);							\
+}											\
+											\
+/* No hash table, scan all symbols */							\
+static void scan_exports##bits(const struct elf_object *obj, uint32_t parent_id,	\
+				const unsigned char *libname, unsigned int depth)	\
+{											\
+    size_t i;										\
+    uint32_t hash;									\
+    const unsigned char *name, *symbol;							\
+    struct sym_list *sym_val;								\
+											\
+    for (i = 0; i < obj->sym_cnt; i++) {						\
+	if (!symbol_is_defined##bits(obj, i) || (name = symbol_name##bits(obj, i)) == NULL) \
+	    continue;									\
+	hash = gnu_hash(name);								\
+	symbol = find_name(name, hash);							\
+	sym_val = symbol ? find_in_sym_list(symbol, hash, parent_id) : NULL;		\
+	if (sym_val != NULL) {								\
+	    sym_val->found = 1;								\
+	    /* Print out found symbol if -v arg was supplied */				\
+	    if (g_verbose)								\
+		printf("%*s%s -> %s\n", (int)depth * 4, "", libname, sym_val->symbol);	\
+	}										\
+    }											\
+}											\
+											\
+/* Intern libs listed in DT_NEEDED entries, mapping is gone once they are processed */ \
+static void collect_needed##bits(const struct elf_object *obj, struct lib_frame *frame) { \
+											\
+    size_t i, cnt = 0;									\
+    const unsigned char *name;								\
+    const Elf##bits##_Dyn *dyn = obj->dynamic_table.Dyn##bits;				\
+											\
+    for (i = 0; i < obj->dyn_cnt && dyn[i].d_tag != DT_NULL; i++)			\
+	if (dyn[i].d_tag == DT_NEEDED)							\
+	    cnt++;									\
+    if (cnt == 0)									\
+	return;										\
+											\
+    frame->needed = (const unsigned char **)arena_alloc(cnt * sizeof(*frame->needed)); \
+    if (frame->needed == NULL)								\
+	return;										\
+											\
+    for (i = 0; i < obj->dyn_cnt && dyn[i].d_tag != DT_NULL; i++)			\
+	if (dyn[i].d_tag == DT_NEEDED && (name = string_by_index(&obj->string_table, dyn[i].d_un.d_val)) != NULL \
+	    && (name = intern_name(name, gnu_hash(name))) != NULL)			\
+	    frame->needed[frame->needed_cnt++] = name;					\
+}
+
+ELF_LIB_FUNCTIONS(32)
+ELF_LIB_FUNCTIONS(64)
+
+/* Advise kernel to read dynamic section and tables it points to,
+ * which is all that parsing takes from lib besides headers
+ */
+#define ELF_READAHEAD_FUNCTIONS(bits)							\
+static void readahead_tables##bits(int fd, uint64_t base, const unsigned char *head, size_t len) { \
+											\
+    static const int64_t tags[] = { DT_SYMTAB, DT_STRTAB, DT_HASH, DT_GNU_HASH };	\
+    const Elf##bits##_Ehdr *ehdr = (const Elf##bits##_Ehdr *)head;			\
+    const Elf##bits##_Phdr *phdr, *dynamic = NULL;					\
+    Elf##bits##_Dyn *dyn;								\
+    uint64_t addr[4] = { 0 }, offset, lo = UINT64_MAX, hi = 0, strsz = 0;		\
+    size_t i, k, n, size;								\
+    ssize_t ret;									\
+											\
+    if (len < sizeof(*ehdr) || ehdr->e_phentsize != sizeof(*phdr)			\
+	|| ehdr->e_phoff % sizeof(Elf##bits##_Addr) || ehdr->e_phoff > len		\
+	|| ehdr->e_phnum > (len - ehdr->e_phoff) / sizeof(*phdr))			\
+	return;										\
+    phdr = (const Elf##bits##_Phdr *)(head + ehdr->e_phoff);				\
+    for (i = 0; i < ehdr->e_phnum; i++)							\
+	if (phdr[i].p_type == PT_DYNAMIC)						\
+	    dynamic = &phdr[i];								\
+    if (dynamic == NULL || dynamic->p_filesz > READAHEAD_DYN_MAX)			\
+	return;										\
+											\
+    size = dynamic->p_filesz;								\
+    dyn = (Elf##bits##_Dyn *)malloc(size);						\
+    if (dyn == NULL)									\
+	return;										\
+    ret = pread(fd, dyn, size, base + dynamic->p_offset);				\
+    n = ret > 0 ? ret / sizeof(*dyn) : 0;						\
+    for (i = 0; i < n && dyn[i].d_tag != DT_NULL; i++) {				\
+	for (k = 0; k < ARRAY_SIZE(tags); k++)						\
+	    if (dyn[i].d_tag == tags[k])						\
+		addr[k] = dyn[i].d_un.d_ptr;						\
+	if (dyn[i].d_tag == DT_STRSZ)							\
+	    strsz = dyn[i].d_un.d_val;							\
+    }											\
+    free(dyn);										\
+											\
+    /* Tables lie between symbol table and end of string table */			\
+    for (k = 0; k < ARRAY_SIZE(addr); k++)						\
+	for (i = 0; addr[k] != 0 && i < ehdr->e_phnum; i++)				\
+	    if (phdr[i].p_type == PT_LOAD && addr[k] >= phdr[i].p_vaddr			\
+		&& addr[k] - phdr[i].p_vaddr < phdr[i].p_filesz) {			\
+		offset = addr[k] - phdr[i].p_vaddr + phdr[i].p_offset;			\
+		if (offset < lo)							\
+		    lo = offset;							\
+		if (offset + (tags[k] == DT_STRTAB ? strsz : 1) > hi)			\
+		    hi = offset + (tags[k] == DT_STRTAB ? strsz : 1);			\
+		break;									\
+	    }										\
+    if (lo < hi)									\
+	posix_fadvise(fd, base + lo, hi - lo, POSIX_FADV_WILLNEED);			\
+}
+
+ELF_READAHEAD_FUNCTIONS(32)
+ELF_READAHEAD_FUNCTIONS(64)
+
+/* Bring headers and tables of lib into page cache */
+static void readahead_lib(const unsigned char *path) {
+
+    int fd, own = 1;
+    uint64_t base = 0, head[512];
+    ssize_t len;
+    struct vnode node;
+
+    /* Lib stored as is in image file is read from there */
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	if (errno != ENOTDIR || vfs_lookup(path, &node) < 0)
+	    return;
+	if (!S_ISREG(node.mode) || node_locate(&node, 0, node.size, &fd, &base) < 0)
+	    fd = -1;
+	node_free(&node);
+	if (fd < 0)
+	    return;
+	own = 0;
+    }
+
+    len = pread(fd, head, sizeof(head), base);
+    if (len >= EI_NIDENT && !memcmp(head, ELFMAG, SELFMAG)) {
+	if (((unsigned char *)head)[EI_CLASS] == ELFCLASS32)
+	    readahead_tables32(fd, base, (unsigned char *)head, len);
+	else if (((unsigned char *)head)[EI_CLASS] == ELFCLASS64)
+	    readahead_tables64(fd, base, (unsigned char *)head, len);
+    }
+
+    if (own)
+	close(fd);
+}
+
+static void* readahead_worker(void *arg) {
+
+    unsigned char *path;
+
+    (void)arg;
+    for (;;) {
+	pthread_mutex_lock(&g_readahead_lock);
+	while (g_readahead_head == g_readahead_tail && !g_readahead_stop)
+	    pthread_cond_wait(&g_readahead_cond, &g_readahead_lock);
+	if (g_readahead_stop) {
+	    pthread_mutex_unlock(&g_readahead_lock);
+	    break;
+	}
+	path = g_readahead_queue[g_readahead_head++];
+	pthread_mutex_unlock(&g_readahead_lock);
+
+	readahead_lib(path);
+	free(path);
+    }
+
+    return NULL;
+}
+
+static void readahead_push(const unsigned char *path) {
+
+    unsigned char *copy, **queue;
+    size_t size;
+
+    if ((copy = strdup(path)) == NULL)
+	return;
+
+    pthread_mutex_lock(&g_readahead_lock);
+
+    if (g_readahead_tail == g_readahead_size) {
+	if (g_readahead_head > 0) {
+	    memmove(g_readahead_queue, g_readahead_queue + g_readahead_head,
+		    (g_readahead_tail - g_readahead_head) * sizeof(unsigned char *));
+	    g_readahead_tail -= g_readahead_head;
+	    g_readahead_head = 0;
+	}
+	else {
+	    size = g_readahead_size ? g_readahead_size * 2 : 64;
+	    queue = (unsigned char **)realloc(g_readahead_queue, size * sizeof(unsigned char *));
+	    if (queue == NULL) {
+		pthread_mutex_unlock(&g_readahead_lock);
+		free(copy);
+		return;
+	    }
+	    g_readahead_queue = queue;
+	    g_readahead_size = size;
+	}
+    }
+    g_readahead_queue[g_readahead_tail++] = copy;
+    pthread_cond_signal(&g_readahead_cond);
+
+    pthread_mutex_unlock(&g_readahead_lock);
+}
+
+/* Queue needed libs of frame which are neither visited nor parsed yet,
+ * so that their reading overlaps with processing of the current lib
+ */
+static void readahead_needed(const struct lib_frame *frame) {
+
+    size_t i;
+    const unsigned char *libname;
+    struct intern_name *name;
+    unsigned char path[PATH_MAX];
+
+    for (i = 0; i < frame->needed_cnt; i++) {
+	libname = intern_name(frame->needed[i], gnu_hash(frame->needed[i]));
+	if (libname == NULL)
+	    return;
+	name = (struct intern_name *)(libname - offsetof(struct intern_name, str));
+	if (name->lib_id != NO_LIB || name->readahead)
+	    continue;
+	name->readahead = 1;
+
+	if (find_lib(libname, path) < 0 || (g_use_cache && cache_find(path) != NULL))
+	    continue;
+	readahead_push(path);
+    }
+}
+
+/* Prefetch workers parse libs up front, otherwise a helper thread reads ahead */
+static void readahead_start(void) {
+
+    if (g_jobs > 1)
+	return;
+
+    g_readahead_stop = 0;
+    g_readahead_on = !pthread_create(&g_readahead_thread, NULL, readahead_worker, NULL);
+}
+
+static void readahead_stop(void) {
+
+    if (!g_readahead_on)
+	return;
+
+    pthread_mutex_lock(&g_readahead_lock);
+    g_readahead_stop = 1;
+    pthread_cond_signal(&g_readahead_cond);
+    pthread_mutex_unlock(&g_readahead_lock);
+    pthread_join(g_readahead_thread, NULL);
+    g_readahead_on = 0;
+
+    while (g_readahead_head < g_readahead_tail)
+	free(g_readahead_queue[g_readahead_head++]);
+    g_readahead_head = g_readahead_tail = 0;
+}
+
+/* Parse lib and resolve symbols required by its parent,
+ * libs it depends on are left in frame for the caller
+ */
+static int visit_lib(struct lib_frame *frame) {
+
+    int ret = 0;
+    uint32_t i;
+    const unsigned char *libname = frame->name;
+    uint32_t id = frame->id, parent_id = frame->parent_id;
+    int pad = frame->depth * 4;
+    const uint8_t *ident;
+    struct elf_image image;
+    struct elf_object obj;
+    const unsigned char *build_id;
+    const char *error;
+    uint8_t build_id_len;
+    struct cache_entry *entry = NULL;
+    unsigned char path[PATH_MAX];
+    struct stats_time start, t;
+    size_t sym_cnt, lookups = 0;
+
+    stats_start(&start);
+    t = start;
+
+    /* At the first pass, open lib explicitly.
+     * Otherwise, look for lib in directories
+     */
+    if (id == 0)
+	snprintf(path, PATH_MAX, "%s", libname);
+    else if (find_lib(libname, path) < 0) {
+	ret = errno;
+	printf("%*s%s: " RED "%s" RESET "\n", pad, "", libname, strerror(ret));
+	goto exit;
+    }
+    stats_phase(PHASE_PROBE, &t);
+
+    /* Lib was already parsed during this run */
+    image.base = NULL;
+    if (g_use_cache && (entry = cache_find(path)) != NULL) {
+	if (id == 0)
+	    g_elf_class = entry->rec->elf_class;
+	if (entry->rec->elf_class == g_elf_class) {
+	    STAT_ADD(g_stat_reused, 1);
+	    goto resolve;
+	}
+	entry = NULL;
+    }
+
+    /* Lib unchanged since it was indexed is neither mapped nor parsed */
+    if (g_use_cache && (entry = cache_probe(path, id == 0)) != NULL) {
+	STAT_ADD(g_stat_reused, 1);
+	goto resolve;
+    }
+
+    /* Mapping stays valid after descriptor is closed */
+    ret = open_image(path, &image);
+    stats_phase(PHASE_MAP, &t);
+    if (ret < 0) {
+	ret = -ret;
+	printf("%*s%s: " RED "%s" RESET "\n", pad, "", libname, strerror(ret));
+	goto exit;
+    }
+    STAT_ADD(g_stat_opened, 1);
+
+    ident = image.base;
+    if (strncmp(ident, ELFMAG, SELFMAG) != 0) {
+	printf("%*s%s: " RED "Not ELF format" RESET "\n", pad, "", libname);
+	if (id == 0)
+	    g_target_status = TARGET_INVALID;
+	ret = EILSEQ;
+	goto exit_image;
+    }
+
+    if (id == 0) {
+	g_elf_class = ident[EI_CLASS];
+	if (g_elf_class != ELFCLASS32 && g_elf_class != ELFCLASS64) {
+	    printf("%*s%s: " RED "Invalid ELF class" RESET "\n", pad, "", libname);
+	    g_target_status = TARGET_INVALID;
+	    ret = EINVAL;
+	    goto exit_image;
+	}
+    }
+    else
+	if (ident[EI_CLASS] != g_elf_class) {
+	    if (g_elf_class == ELFCLASS32)
+		printf("%*s%s: " RED "Not ELF32 class" RESET "\n", pad, "", libname);
+	    else
+		printf("%*s%s: " RED "Not ELF64 class" RESET "\n", pad, "", libname);
+
+	    ret = EINVAL;
+	    goto exit_image;
+	}
+
+    if (ident[EI_DATA] != ELFDATA2LSB) {
+	printf("%*s%s: " RED "not little endian data" RESET "\n", pad, "", libname);
+	ret = EINVAL;
+	goto exit_image;
+    }
+
+
+    ret = parse_object(&image, &obj, &error);
+    if (ret == -ENOENT && id == 0 && ((g_elf_class == ELFCLASS32 && obj.header.Ehdr32->e_type != ET_DYN)
+			 || (g_elf_class == ELFCLASS64 && obj.header.Ehdr64->e_type != ET_DYN))) {
+	printf("%s: " GREEN "Statically linked" RESET "\n", libname);
+	g_target_status = TARGET_STATIC;
+	ret = 0;
+	goto exit_image;
+    }
+    if (ret < 0) {
+	printf("%*s%s: " RED "%s" RESET "\n", pad, "", libname, error);
+	ret = -ret;
+	goto exit_image;
+    }
+    STAT_ADD(g_stat_parsed, 1);
+
+    /* Take lib from export index if it is unchanged since last run,
+     * otherwise index it
+     */
+    if (g_use_cache) {
+	read_build_id(&image, &obj, &build_id, &build_id_len);
+	entry = cache_lookup(path, &image, build_id, build_id_len);
+	if (entry == NULL)
+	    entry = cache_store(path, &image, &obj, build_id, build_id_len);
+    }
+
+resolve:
+    stats_phase(PHASE_PARSE, &t);
+    sym_cnt = g_sym_cnt;
+
+    if (!g_silent)
+	printf("%*s%s\n", pad, "", libname);
+
+    /* Fill in list of required symbols */
+    if (frame->depth < g_depth || g_full) {
+	if (entry != NULL)
+	    for (i = 0; i < entry->rec->import_cnt; i++)
+		add_in_sym_list(entry->imports[i], id);
+	else if (g_elf_class == ELFCLASS32)
+	    add_imports32(&obj, id);
+	else
+	    add_imports64(&obj, id);
+    }
+    stats_phase(PHASE_IMPORTS, &t);
+
+    /* Symbols are resolved once whole load set is indexed */
+    if (g_global) {
+	if (entry != NULL)
+	    add_exports(entry, id);
+    }
+    /* Look for required symbols */
+    else if (id != 0) {
+	if (entry == NULL)
+	    read_hash_table(&image, &obj);
+
+	if (entry != NULL || obj.hash.type != DT_NULL) {
+	    /* Probe index or hash table once per symbol required by parent */
+	    struct sym_list *sym_val = parent_id < g_lib_syms_size ? g_lib_syms[parent_id].head : NULL;
+	    for (; sym_val != NULL; sym_val = sym_val->lib_next, lookups++)
+		if (entry != NULL ? cache_has_export(entry, sym_val->symbol, sym_val->hash)
+				  : lookup_symbol(&obj, sym_val->symbol, sym_val->hash)) {
+		    sym_val->found = 1;
+		    /* Print out found symbol if -v arg was supplied */
+		    if (g_verbose)
+			printf("%*s%s -> %s\n", pad, "", libname, sym_val->symbol);
+		}
+	}
+	else if (g_elf_class == ELFCLASS32)
+	    scan_exports32(&obj, parent_id, libname, frame->depth);
+	else
+	    scan_exports64(&obj, parent_id, libname, frame->depth);
+    }
+
+    stats_phase(PHASE_RESOLVE, &t);
+    /* Children are accounted on their own */
+    stats_lib(path, &start, g_sym_cnt - sym_cnt, lookups);
+
+    /* Read DT_NEEDED from .dynamic section table,
+     * required libs are processed by caller
+     */
+    if (frame->depth < g_depth || g_full || g_global) {
+	if (entry != NULL) {
+	    frame->needed = entry->needed;
+	    frame->needed_cnt = entry->rec->needed_cnt;
+	}
+	else if (g_elf_class == ELFCLASS32)
+	    collect_needed32(&obj, frame);
+	else
+	    collect_needed64(&obj, frame);
+
+	if (g_readahead_on)
+	    readahead_needed(frame);
+    }
+    frame->state = LIB_SHIM;
+
+exit_image:
+    if (image.base != NULL)
+	unmap_image(&image);
+exit:
+    return ret;
+}
+
+static struct lib_frame* push_lib(const unsigned char *libname, uint32_t id, uint32_t parent_id,
+				  uint32_t depth, uint8_t is_shim)
+{
+    struct lib_frame *frame;
+    size_t size;
+
+    if (g_frame_cnt >= g_frame_size) {
+	size = g_frame_size ? g_frame_size * 2 : 64;
+	frame = (struct lib_frame *)realloc(g_frames, size * sizeof(struct lib_frame));
+	if (frame == NULL)
+	    return NULL;
+	g_frames = frame;
+	g_frame_size = size;
+    }
+
+    frame = &g_frames[g_frame_cnt++];
+    memset(frame, 0, sizeof(*frame));
+    frame->name = libname;
+    frame->id = id;
+    frame->parent_id = parent_id;
+    frame->depth = depth;
+    frame->is_shim = is_shim;
+    frame->shim = -1;
+    frame->state = LIB_VISIT;
+
+    return frame;
+}
+
+/* Walk dependency graph depth first from an explicit stack, so that
+ * neither depth nor number of libs is bounded by the call stack.
+ * Returns status of the last processed DT_NEEDED lib like the walk
+ * would if it was recursive
+ */
+static int process_lib(const unsigned char *libname, uint32_t id, uint32_t parent_id) {
+
+    int i, n, ret = 0;
+    const unsigned char *name;
+    struct lib_frame *frame;
+
+    g_frame_cnt = 0;
+    if (push_lib(libname, id, parent_id, 0, 0) == NULL)
+	return ENOMEM;
+
+    while (g_frame_cnt > 0) {
+	/* Stack may move on push */
+	frame = &g_frames[g_frame_cnt - 1];
+
+	switch (frame->state) {
+	case LIB_VISIT:
+	    frame->state = LIB_DONE;
+	    frame->ret = visit_lib(frame);
+	    break;
+
+	case LIB_SHIM:
+	    /* Shim libs are processed one by one at the same level as their counterpart */
+	    i = frame->shim < 0 ? has_shim(frame->name) : next_shim(frame->shim);
+	    if (i < 0) {
+		frame->state = LIB_NEEDED;
+		break;
+	    }
+	    frame->shim = i;
+	    if (!g_shimlibs[i].processed)
+		if ((n = add_in_lib_list(g_shimlibs[i].shim, frame->parent_id)) > 0) {
+		    /* Avoid dead loop when shim lib
+		     * depends from its counterpart
+		     */
+		    g_shimlibs[i].processed = 1;
+
+		    if (push_lib(g_shimlibs[i].shim, n, frame->parent_id, frame->depth, 1) == NULL)
+			return ENOMEM;
+		}
+	    break;
+
+	case LIB_NEEDED:
+	    if (frame->next >= frame->needed_cnt) {
+		frame->state = LIB_DONE;
+		break;
+	    }
+	    name = frame->needed[frame->next++];
+	    n = add_in_lib_list(name, frame->id);
+	    if (n > 0 && push_lib(name, n, frame->id, frame->depth + 1, 0) == NULL)
+		return ENOMEM;
+	    break;
+
+	default:
+	    /* Status of shim lib is not reported to the parent */
+	    ret = frame->ret;
+	    g_frame_cnt--;
+	    if (g_frame_cnt > 0 && !frame->is_shim)
+		g_frames[g_frame_cnt - 1].ret = ret;
+	    break;
+	}
+    }
+
+    return ret;
+}
+
+/* Bind required symbols to the first provider in load order */
+static void resolve_global(void) {
+
+    const struct global_export *export;
+    struct sym_list *sym_val;
+
+    for (sym_val = g_symlist; sym_val != NULL; sym_val = sym_val->next) {
+	export = find_export(sym_val->symbol, sym_val->hash);
+	if (export == NULL)
+	    continue;
+	sym_val->found = 1;
+	/* Print out found symbol if -v arg was supplied */
+	if (g_verbose)
+	    printf("%s -> %s\n", g_liblist[export->lib_id].name, sym_val->symbol);
+    }
+}
+
+/* Load whole dependency closure breadth first like the linker does,
+ * so lib_id order is search order, then look up every required symbol
+ * once in exports merged over the load set
+ */
+static int process_global(const unsigned char *libname) {
+
+    int i, ret = 0, err;
+    size_t id, k;
+    struct lib_frame frame;
+    struct stats_time t;
+
+    for (id = 0; id < g_lib_cnt; id++) {
+	memset(&frame, 0, sizeof(frame));
+	frame.name = id == 0 ? libname : g_liblist[id].name;
+	frame.id = id;
+	frame.parent_id = g_liblist[id].parent_id;
+	frame.depth = g_liblist[id].depth;
+	frame.state = LIB_DONE;
+
+	if ((err = visit_lib(&frame)) != 0)
+	    ret = err;
+	if (frame.state == LIB_DONE) {
+	    if (id == 0)
+		return ret;
+	    continue;
+	}
+
+	/* Shim libs are loaded along with their counterpart */
+	for (i = has_shim(frame.name); i >= 0; i = next_shim(i))
+	    add_in_lib_list(g_shimlibs[i].shim, frame.parent_id);
+
+	for (k = 0; k < frame.needed_cnt; k++)
+	    add_in_lib_list(frame.needed[k], id);
+    }
+
+    stats_start(&t);
+    resolve_global();
+    stats_phase(PHASE_RESOLVE, &t);
+
+    return ret;
+}
+
+/* Daemon gets told about changed objects of watched directories */
+static void watch_dir(const unsigned char *path) {
+
+    int wd;
+    size_t i;
+    struct watch *watches;
+
+    if (g_inotify < 0)
+	return;
+
+    for (i = 0; i < g_watch_cnt; i++)
+	if (!strcmp(g_watches[i].path, path))
+	    return;
+
+    wd = inotify_add_watch(g_inotify, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+			| IN_CREATE | IN_DELETE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if (wd < 0)
+	return;
+
+    if (g_watch_cnt == g_watch_size) {
+	g_watch_size = g_watch_size ? g_watch_size * 2 : 32;
+	watches = (struct watch *)realloc(g_watches, g_watch_size * sizeof(struct watch));
+	if (watches == NULL) {
+	    inotify_rm_watch(g_inotify, wd);
+	    return;
+	}
+	g_watches = watches;
+    }
+    g_watches[g_watch_cnt].wd = wd;
+    g_watches[g_watch_cnt].path = strdup(path);
+    g_watch_cnt++;
+}
+
+/* Invalidate index entries of changed objects */
+static void read_watches(void) {
+
+    size_t i;
+    ssize_t len;
+    unsigned char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    unsigned char path[PATH_MAX];
+    const struct inotify_event *event;
+    const unsigned char *p;
+
+    if (g_inotify < 0)
+	return;
+
+    while ((len = read(g_inotify, buf, sizeof(buf))) > 0)
+	for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+	    event = (const struct inotify_event *)p;
+
+	    /* Events were lost */
+	    if (event->mask & IN_Q_OVERFLOW) {
+		lib_index_free();
+		for (i = 0; i < g_watch_cnt; i++)
+		    cache_invalidate(g_watches[i].path);
+		continue;
+	    }
+
+	    for (i = 0; i < g_watch_cnt; i++)
+		if (g_watches[i].wd == event->wd)
+		    break;
+	    if (i == g_watch_cnt)
+		continue;
+
+	    if (event->len > 0) {
+		snprintf(path, PATH_MAX, "%s/%s", g_watches[i].path, event->name);
+		cache_invalidate(path);
+		/* Directories are listed again on next request */
+		lib_index_free();
+	    }
+	    else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+		cache_invalidate(g_watches[i].path);
+		lib_index_free();
+	    }
+
+	    /* Directory is gone, it is watched again once used */
+	    if (event->mask & IN_IGNORED) {
+		free(g_watches[i].path);
+		g_watches[i] = g_watches[--g_watch_cnt];
+	    }
+	}
+}
+
+static void add_dir(const unsigned char *parent_path, const unsigned char *dir) {
+
+    size_t size;
+    unsigned char path[PATH_MAX], *copy, **paths;
+
+    if (snprintf(path, PATH_MAX, "%s%s", parent_path, dir) >= PATH_MAX || access_path(path, F_OK))
+	return;
+
+    if (g_path_cnt >= g_path_size) {
+	size = g_path_size ? g_path_size * 2 : 16;
+	paths = (unsigned char **)realloc(g_paths, size * sizeof(unsigned char *));
+	if (paths == NULL)
+	    return;
+	memset(paths + g_path_size, 0, (size - g_path_size) * sizeof(unsigned char *));
+	g_paths = paths;
+	g_path_size = size;
+    }
+
+    /* Slots past custom directories are reused by every target */
+    copy = strdup(path);
+    if (copy == NULL)
+	return;
+    free(g_paths[g_path_cnt]);
+    g_paths[g_path_cnt] = copy;
+
+    watch_dir(g_paths[g_path_cnt]);
+    g_path_cnt++;
+}
+
+static int strpos(const char *str, const char *substr) {
+
+    char *ret = strstr(str, substr);
+    if (ret == NULL)
+	return -1;
+    else
+	return ret - str;
+}
+
+static unsigned char* str_replace(unsigned char *str, const unsigned char *substr,
+						const unsigned char *replace)
+{
+    static unsigned char buf[PATH_MAX];
+    size_t len;
+    int pos;
+
+    pos = strpos(str, substr);
+    if (pos < 0 || (strlen(str) - strlen(substr) + strlen(replace)) >= PATH_MAX)
+	return str;
+
+    len = strlen(substr);
+    strncpy(buf, str, pos);
+    sprintf(buf + pos, "%s%s", replace, str + pos + len);
+    return buf;
+}
+
+static const unsigned char* get_lib_by_id(uint32_t lib_id) {
+
+    return lib_id < g_lib_cnt ? g_liblist[lib_id].name : NULL;
+}
+
+/* Custom directories are searched before directories of target */
+static void add_custom_dir(const unsigned char *dir) {
+
+    unsigned char *full_path;
+
+    if ((full_path = real_path(str_replace((unsigned char *)dir, "~", g_home))) == NULL)
+	printf("Warning: \"%s\": %s\n", dir, strerror(errno));
+    else {
+	g_path_cnt = g_cust_path;
+	add_dir(full_path, "");
+	free(full_path);
+	g_cust_path = g_path_cnt;
+    }
+}
+
+static int add_shim(const unsigned char *lib, const unsigned char *shim) {
+
+    size_t size;
+    struct shim_libs *shims;
+
+    if (*lib == '\0' || *shim == '\0' || strlen(lib) > NAME_MAX || strlen(shim) > NAME_MAX)
+	return -EINVAL;
+
+    if (g_shim_cnt >= g_shim_size) {
+	size = g_shim_size ? g_shim_size * 2 : 32;
+	shims = (struct shim_libs *)realloc(g_shimlibs, size * sizeof(struct shim_libs));
+	if (shims == NULL)
+	    return -ENOMEM;
+	g_shimlibs = shims;
+	g_shim_size = size;
+    }
+
+    strcpy(g_shimlibs[g_shim_cnt].lib, lib);
+    strcpy(g_shimlibs[g_shim_cnt].shim, shim);
+    g_shimlibs[g_shim_cnt].hash = gnu_hash(lib);
+    g_shimlibs[g_shim_cnt].processed = 0;
+    g_shim_cnt++;
+
+    return 0;
+}
+
+/* Read shims and custom directories from manifest, one per line:
+ *     shim <lib> <shim>
+ *     path <dir>
+ * Empty lines and lines starting with '#' are skipped
+ */
+static int add_manifest(const unsigned char *manifest) {
+
+    FILE *f;
+    int ret = 0;
+    size_t len, line_no = 0;
+    unsigned char line[PATH_MAX + 8], *key, *value, *shim, path[PATH_MAX];
+
+    /* Name may be in buffer of str_replace, which path entries reuse */
+    snprintf(path, PATH_MAX, "%s", manifest);
+    manifest = path;
+
+    f = fopen(manifest, "r");
+    if (f == NULL)
+	return -errno;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+	line_no++;
+	len = strlen(line);
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t'))
+	    line[--len] = '\0';
+	key = line + strspn(line, " \t");
+	if (*key == '\0' || *key == '#')
+	    continue;
+
+	value = key + strcspn(key, " \t");
+	if (*value != '\0')
+	    *value++ = '\0';
+	value += strspn(value, " \t");
+
+	if (!strcmp(key, "path") && *value != '\0')
+	    add_custom_dir(value);
+	else if (!strcmp(key, "shim")) {
+	    shim = value + strcspn(value, " \t");
+	    if (*shim != '\0')
+		*shim++ = '\0';
+	    shim += strspn(shim, " \t");
+	    if ((ret = add_shim(value, shim)) == -ENOMEM)
+		break;
+	    if (ret < 0)
+		printf("Warning: %s:%zu: Invalid shim\n", manifest, line_no);
+	    ret = 0;
+	}
+	else
+	    printf("Warning: %s:%zu: Unknown entry \"%s\"\n", manifest, line_no, key);
+    }
+    fclose(f);
+
+    return ret;
+}
+
+static void usage(char * program_name) {
+
+    printf("Usage: %s [option(s)] <file|dir>...\n", program_name);
+    printf(" Lists external symbols of prebuilt proprietary ELF <file> which\n"
+	" were not found in needed compiled Android's shared objects.\n"
+	" <file> assumed to be in out/target/product//system/bin/ or\n"
+	"			 out/target/product//system/lib*/ or\n"
+	"			 out/target/product//system/vendor/lib*/\n"
+	" Several files may be checked at once, each ELF file of <dir> is checked\n"
+	" in case of directory. Paths may lead into ext4 images (raw or sparse) and\n"
+	" zip archives, e.g. system.img/lib64/libfoo.so or ota.zip/system/bin/rild.\n");
+    printf(" The options are:\n");
+    printf(" -v, --verbose		Show found symbols\n");
+    printf(" -s, --silent		Show result only\n");
+    printf(" --depth <n>		Set recursion depth to <n>, default value is 1\n");
+    printf(" --full			Full depth recursion\n");
+    printf(" --global		Resolve symbols against exports of all loaded shared objects\n");
+    printf("			in linker search order\n");
+    printf(" -i <path>		Include custom paths where to look for needed shared objects\n");
+    printf("			Use colon-separated list in case of multiple values\n");
+    printf(" --shim <lib|shim>	Supply shim counterpart for shared object\n");
+    printf("			Use colon-separated list in case of multiple values\n");
+    printf(" --manifest <file>	Read \"shim <lib> <shim>\" and \"path <dir>\" lines from <file>\n");
+    printf(" --demangle		Decode low-level symbol names into user-level names\n");
+    printf(" --suggest		Show shared objects of search directories which export missing\n");
+    printf("			symbols or other overloads of them\n");
+    printf(" --cache		Keep index of shared objects in $XDG_CACHE_HOME/symdep\n");
+    printf("			and reuse it for objects which were not changed\n");
+    printf(" -l, --list <file>	Check files listed in <file>, one per line\n");
+    printf(" -j <n>			Parse needed shared objects on <n> threads\n");
+    printf(" --sweep <dir>		Check every ELF object of system <dir>\n");
+    printf(" --symdb <file>		Look for needed shared objects in symbol database <file>\n");
+    printf("			instead of ROM tree\n");
+    printf(" --make-symdb <dir>	Write symbol database of system <dir> to --symdb <file>\n");
+    printf(" --diff <old> <new>	List exports which vanished between system trees <old> and <new>\n");
+    printf("			and objects of <new> which import them\n");
+    printf(" --stats		Print timings of phases, I/O counters and cost of each\n");
+    printf("			shared object to stderr\n");
+    printf(" --serve			Run as daemon which keeps shared objects parsed in memory\n");
+    printf(" --client		Let running daemon check <file|dir>, other options are passed\n");
+    printf(" --socket <path>		Unix socket of daemon, default is $XDG_RUNTIME_DIR/symdep.sock\n");
+    printf(" -h, --help		Display this information\n\n");
+    printf("Report bugs to: https://github.com/Kostyan-nsk/symdep/issues\n");
+}
+
+static int add_target(const unsigned char *path) {
+
+    unsigned char **targets;
+
+    if (g_target_cnt == g_target_size) {
+	g_target_size = g_target_size ? g_target_size * 2 : 16;
+	targets = (unsigned char **)realloc(g_targets, g_target_size * sizeof(unsigned char *));
+	if (targets == NULL)
+	    return -ENOMEM;
+	g_targets = targets;
+    }
+
+    g_targets[g_target_cnt] = strdup(path);
+    if (g_targets[g_target_cnt] == NULL)
+	return -ENOMEM;
+    g_target_cnt++;
+
+    return 0;
+}
+
+static int is_elf_file(const unsigned char *path) {
+
+    unsigned char ident[EI_NIDENT];
+
+    return !read_ident(path, ident) && !memcmp(ident, ELFMAG, SELFMAG);
+}
+
+static int cmp_str(const void *a, const void *b) {
+
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* Order of soname table of symdb */
+static int cmp_symdb_name(const void *a, const void *b) {
+
+    const struct symdb_name *x = (const struct symdb_name *)a, *y = (const struct symdb_name *)b;
+    int ret;
+
+    if (x->lib.elf_class != y->lib.elf_class)
+	return x->lib.elf_class < y->lib.elf_class ? -1 : 1;
+    if ((ret = strcmp(x->name, y->name)))
+	return ret;
+
+    return x->lib.record < y->lib.record ? -1 : x->lib.record > y->lib.record;
+}
+
+static int add_target_entry(void *dir, const unsigned char *name, uint8_t type) {
+
+    struct stat st;
+    unsigned char path[PATH_MAX];
+
+    if (type != DT_REG && type != DT_LNK && type != DT_UNKNOWN)
+	return 0;
+    if (snprintf(path, PATH_MAX, "%s/%s", (const unsigned char *)dir, name) >= PATH_MAX)
+	return 0;
+    /* Only symlinks and entries of unknown type need stat */
+    if (type != DT_REG && (stat_path(path, &st) < 0 || !S_ISREG(st.st_mode)))
+	return 0;
+    if (!is_elf_file(path))
+	return 0;
+
+    return add_target(path);
+}
+
+/* Add every ELF file of directory in name order */
+static int add_target_dir(const unsigned char *dir) {
+
+    size_t first = g_target_cnt;
+    int ret;
+
+    if ((ret = list_dir(dir, add_target_entry, (void *)dir)) < 0)
+	return ret;
+
+    if (g_target_cnt > first)
+	qsort(g_targets + first, g_target_cnt - first, sizeof(unsigned char *), cmp_str);
+
+    return 0;
+}
+
+/* Add files listed one per line, empty lines and lines starting with '#' are skipped */
+static int add_target_list(const unsigned char *list) {
+
+    FILE *f;
+    size_t len;
+    unsigned char line[PATH_MAX];
+
+    f = fopen(list, "r");
+    if (f == NULL)
+	return -errno;
+
+    while (fgets(line, PATH_MAX, f) != NULL) {
+	len = strlen(line);
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' '))
+	    line[--len] = '\0';
+	if (len == 0 || line[0] == '#')
+	    continue;
+	if (add_target(line) < 0) {
+	    fclose(f);
+	    return -ENOMEM;
+	}
+    }
+    fclose(f);
+
+    return 0;
+}
+
+/* Add every ELF object of system tree */
+static int add_sweep_dirs(const unsigned char *root) {
+
+    static const char * const dirs[] = {
+	"bin", "xbin", "lib", "lib/hw", "lib64", "lib64/hw",
+	"vendor/bin", "vendor/lib", "vendor/lib/hw", "vendor/lib64", "vendor/lib64/hw",
+    };
+    size_t i;
+    int ret;
+    unsigned char path[PATH_MAX];
+
+    for (i = 0; i < ARRAY_SIZE(dirs); i++) {
+	snprintf(path, PATH_MAX, "%s/%s", root, dirs[i]);
+	if (access_path(path, F_OK))
+	    continue;
+	ret = add_target_dir(path);
+	if (ret < 0)
+	    return ret;
+    }
+
+    return 0;
+}
+
+/* Parse shared object of ROM into record of symdb */
+static struct cache_entry* symdb_store(const unsigned char *path, const unsigned char *rom_path) {
+
+    struct elf_image image;
+    struct elf_object obj;
+    struct cache_entry *entry = NULL;
+    const unsigned char *build_id;
+    uint8_t build_id_len;
+    const char *error;
+
+    if (open_image(path, &image) < 0)
+	return NULL;
+
+    g_elf_class = image.base[EI_CLASS];
+    if ((g_elf_class == ELFCLASS32 || g_elf_class == ELFCLASS64)
+	&& image.base[EI_DATA] == ELFDATA2LSB && !parse_object(&image, &obj, &error)) {
+	    read_build_id(&image, &obj, &build_id, &build_id_len);
+	    entry = cache_store(rom_path, &image, &obj, build_id, build_id_len);
+	    /* Record doesn't belong to export index */
+	    if (entry != NULL)
+		entry->symdb = 1;
+    }
+
+    unmap_image(&image);
+    return entry;
+}
+
+/* Write symdb of system directory: records of shared objects of
+ * vendor/lib*, lib* directories in search order
+ */
+static int make_symdb(void) {
+
+    static const char * const dirs[] = { "vendor/lib", "vendor/lib64", "lib", "lib64" };
+    int fd, ret = 0;
+    size_t i, t, first = g_target_cnt, cnt = 0, class_cnt[2] = { 0, 0 };
+    uint64_t record;
+    struct cache_entry *entry, **entries = NULL;
+    struct symdb_name *names = NULL;
+    struct symdb_lib *libs = NULL;
+    const unsigned char *rec_path;
+    unsigned char path[PATH_MAX], tmp_path[PATH_MAX + 16];
+
+    if (g_symdb == NULL) {
+	printf("Missing argument \"--symdb\"\n");
+	return EINVAL;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(dirs); i++) {
+	snprintf(path, PATH_MAX, "%s/%s", g_make_symdb, dirs[i]);
+	if (access_path(path, F_OK))
+	    continue;
+	if ((ret = add_target_dir(path)) < 0)
+	    goto exit;
+    }
+
+    entries = (struct cache_entry **)malloc((g_target_cnt - first + 1) * sizeof(struct cache_entry *));
+    if (entries == NULL) {
+	ret = -ENOMEM;
+	goto exit;
+    }
+
+    /* Objects are keyed by their path in ROM */
+    for (t = first; t < g_target_cnt; t++) {
+	snprintf(path, PATH_MAX, "system%s", g_targets[t] + strlen(g_make_symdb));
+	entry = symdb_store(g_targets[t], path);
+	if (entry == NULL)
+	    continue;
+	entries[cnt++] = entry;
+	class_cnt[entry->rec->elf_class == ELFCLASS64]++;
+    }
+
+    /* Soname table comes first, records follow in search order */
+    names = (struct symdb_name *)calloc(cnt + 1, sizeof(struct symdb_name));
+    libs = (struct symdb_lib *)calloc(cnt + 1, sizeof(struct symdb_lib));
+    if (names == NULL || libs == NULL) {
+	ret = -ENOMEM;
+	goto exit;
+    }
+    record = CACHE_MAGIC_SIZE + sizeof(uint64_t) + cnt * sizeof(struct symdb_lib);
+    for (i = 0; i < cnt; i++) {
+	rec_path = cache_record_path(entries[i]->rec);
+	names[i].name = (const unsigned char *)strrchr(rec_path, '/') + 1;
+	names[i].lib.record = record;
+	names[i].lib.name = record + (names[i].name - (const unsigned char *)entries[i]->rec);
+	names[i].lib.elf_class = entries[i]->rec->elf_class;
+	record += entries[i]->rec->record_size;
+    }
+    qsort(names, cnt, sizeof(struct symdb_name), cmp_symdb_name);
+    for (i = 0; i < cnt; i++)
+	libs[i] = names[i].lib;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", g_symdb, getpid());
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	ret = -errno;
+	goto exit;
+    }
+
+    record = cnt;
+    ret = write(fd, SYMDB_MAGIC, CACHE_MAGIC_SIZE) == CACHE_MAGIC_SIZE
+	&& write(fd, &record, sizeof(record)) == sizeof(record)
+	&& write(fd, libs, cnt * sizeof(struct symdb_lib)) == (ssize_t)(cnt * sizeof(struct symdb_lib)) ? 0 : -EIO;
+    for (i = 0; i < cnt && ret == 0; i++)
+	if (write(fd, entries[i]->rec, entries[i]->rec->record_size) != entries[i]->rec->record_size)
+	    ret = -EIO;
+    close(fd);
+
+    if (ret == 0 && rename(tmp_path, g_symdb) < 0)
+	ret = -errno;
+    if (ret < 0)
+	unlink(tmp_path);
+
+exit:
+    free(entries);
+    free(names);
+    free(libs);
+    symdb_close();
+
+    if (ret < 0) {
+	printf("%s: " RED "%s" RESET "\n", g_symdb, strerror(-ret));
+	return -ret;
+    }
+
+    if (!g_silent)
+	printf("%zu shared objects written to %s (ELF32: %zu, ELF64: %zu)\n",
+		cnt, g_symdb, class_cnt[0], class_cnt[1]);
+
+    return 0;
+}
+
+/* Returns allocated real path of system directory,
+ * product directory is accepted as well
+ */
+static unsigned char* system_root(const unsigned char *dir) {
+
+    unsigned char *root, path[PATH_MAX];
+
+    root = real_path(str_replace((unsigned char *)dir, "~", g_home));
+    if (root == NULL)
+	return NULL;
+
+    snprintf(path, PATH_MAX, "%s/system", root);
+    if (!access_path(path, F_OK)) {
+	free(root);
+	root = strdup(path);
+    }
+
+    return root;
+}
+
+/* Set up search directories with respect to target location */
+static void add_target_dirs(const unsigned char *target) {
+
+    unsigned char name[NAME_MAX], parent_path[PATH_MAX], buf[PATH_MAX];
+
+    /* Custom directories are kept */
+    g_path_cnt = g_cust_path;
+
+    /* Needed objects are looked for in symdb instead of ROM tree */
+    if (g_symdb_map != NULL) {
+	index_search_dirs();
+	return;
+    }
+
+    /* Parsing paths: name of target directory and its parent */
+    strcpy(buf, target);
+    strcpy(name, basename(dirname(buf)));
+    strcpy(buf, target);
+    strcpy(parent_path, dirname(dirname(buf)));
+
+    /* Assume target ELF object is in
+     *     system/vendor/bin
+     *     system/vendor/sbin
+     *     system/vendor/xbin
+     *     system/vendor/lib
+     *     system/vendor/lib64
+     *     system/vendor/lib/hw
+     *     system/vendor/lib64/hw
+     *     system/lib
+     *     system/lib64
+     *     system/lib/hw
+     *     system/lib64/hw
+     * directories
+     */
+    // In case if we are in "lib*/hw" directory
+    strcpy(buf, parent_path);
+    if((!strcmp(basename(buf), "lib") || !strcmp(basename(buf), "lib64"))
+	&& !strcmp(name, "hw"))
+	    strcpy(parent_path, dirname(buf));
+    if (!strcmp(name, "lib") || !strcmp(name, "lib64") || !strcmp(name, "hw")
+	|| !strcmp(name, "bin") || !strcmp(name, "sbin") || !strcmp(name, "xbin")) {
+
+	    /* In case if we are in system/vendor/lib* directory */
+	    strcpy(buf, parent_path);
+	    if( !strcmp(basename(buf), "vendor")) {
+		strcpy(buf, parent_path);
+		strcpy(parent_path, dirname(buf));
+	    }
+
+	    /* Root of system image is system directory as well */
+	    strcpy(buf, parent_path);
+	    if( !strcmp(basename(buf), "system") || is_volume(parent_path)) {
+		add_dir(parent_path, "/vendor/lib");
+		add_dir(parent_path, "/vendor/lib64");
+		add_dir(parent_path, "/lib");
+		add_dir(parent_path, "/lib64");
+	    }
     }
 
-    symbol_table = read_symbol_table(fd, dynsym);
-    if (symbol_table == NULL) {
-	printf("%s%s: " RED "Error occured while reading table for section .dynsym" RESET "\n", g_padding, libname);
-	ret = EFAULT;
-	goto exit_dynamic;
+    index_search_dirs();
+}
+
+/* Drop lists of previous target */
+static void reset_lists(void) {
+
+    size_t i;
+
+    /* Lists and names live in arena */
+    g_symlist = NULL;
+    g_symlist_tail = NULL;
+    g_lib_cnt = 0;
+    arena_reset();
+
+    if (g_names != NULL)
+	memset(g_names, 0, g_names_size * sizeof(struct intern_name *));
+    g_names_cnt = 0;
+
+    if (g_symhash != NULL)
+	memset(g_symhash, 0, g_symhash_size * sizeof(struct sym_list *));
+    g_sym_cnt = 0;
+
+    if (g_lib_syms != NULL)
+	memset(g_lib_syms, 0, g_lib_syms_size * sizeof(struct lib_syms));
+
+    if (g_exports != NULL)
+	memset(g_exports, 0, g_exports_size * sizeof(struct global_export *));
+    g_exports_cnt = 0;
+
+    for (i = 0; i < g_shim_cnt; i++)
+	g_shimlibs[i].processed = 0;
+
+    g_target_status = TARGET_OK;
+}
+
+/* Decode C++ symbol, each symbol is decoded once per run.
+ * Returns NULL if symbol is not a C++ name
+ */
+static const unsigned char* demangle(const unsigned char *symbol, uint32_t hash) {
+
+    size_t i, size, length, demangled_len = 0;
+    int status = -2;
+    char *buf = NULL;
+    struct demangled_name *name, **table;
+
+    for (name = g_demangled_size ? g_demangled[hash & (g_demangled_size - 1)] : NULL; name != NULL; name = name->next)
+	if (name->hash == hash && !strcmp(name->symbol, symbol))
+	    return name->demangled;
+
+    /* Only names of Itanium C++ ABI are decoded, not types */
+    if (!strncmp(symbol, "_Z", 2)) {
+	buf = __cxa_demangle(symbol, g_demangle_buf, &g_demangle_buf_size, &status);
+	if (status == 0) {
+	    g_demangle_buf = buf;
+	    demangled_len = strlen(buf) + 1;
+	}
     }
 
-    if (g_elf_class == ELFCLASS32)
-	dynstr = section_by_index(&elf_header, dynsym->Shdr32.sh_link, section_table);
-    else
-	dynstr = section_by_index(&elf_header, dynsym->Shdr64.sh_link, section_table);
-    if (dynstr == NULL) {
-	printf("%s%s: " RED "Error occured while reading table for section .dynsym" RESET "\n", g_padding, libname);
-	ret = EFAULT;
-	goto exit_dynamic;
+    if (g_demangled_cnt >= g_demangled_size) {
+	size = g_demangled_size ? g_demangled_size * 2 : 256;
+	table = (struct demangled_name **)calloc(size, sizeof(struct demangled_name *));
+	if (table == NULL)
+	    return NULL;
+	for (i = 0; i < g_demangled_size; i++)
+	    while ((name = g_demangled[i]) != NULL) {
+		g_demangled[i] = name->next;
+		name->next = table[name->hash & (size - 1)];
+		table[name->hash & (size - 1)] = name;
+	    }
+	free(g_demangled);
+	g_demangled = table;
+	g_demangled_size = size;
     }
 
-    string_table = read_string_table(fd, dynstr);
-    if (string_table == NULL) {
-	printf("%s%s: " RED "Error occured while reading table for section .strtab" RESET "\n", g_padding, libname);
-	ret = EFAULT;
-	goto exit_symbol;
+    length = strlen(symbol) + 1;
+    name = (struct demangled_name *)malloc(sizeof(struct demangled_name) + length + demangled_len);
+    if (name == NULL)
+	return NULL;
+    name->hash = hash;
+    memcpy(name->symbol, symbol, length);
+    name->demangled = NULL;
+    if (status == 0) {
+	memcpy(name->symbol + length, buf, demangled_len);
+	name->demangled = name->symbol + length;
     }
+    name->next = g_demangled[hash & (g_demangled_size - 1)];
+    g_demangled[hash & (g_demangled_size - 1)] = name;
+    g_demangled_cnt++;
 
-    if (!g_silent)
-	printf("%s%s\n", g_padding, libname);
+    return name->demangled;
+}
 
-    /* Fill in list of required symbols */
-    if (g_cur_depth <= g_depth || g_full) {
-	if (g_elf_class == ELFCLASS32) {
-	    n = dynsym->Shdr32.sh_size / sizeof(Elf32_Sym);
-	    for (i = 0; i < n; i++) {
-		if (symbol_table[i].Sym32.st_shndx == SHN_UNDEF
-		    /* Skip weak symbols */
-		    && ELF32_ST_BIND(symbol_table[i].Sym32.st_info) != STB_WEAK)
-		{
-			if (strlen(&string_table[symbol_table[i].Sym32.st_name]) > 0)
-			    add_in_sym_list(&string_table[symbol_table[i].Sym32.st_name], id);
-		}
-	    }
-	}
-	else {
-	    n = dynsym->Shdr64.sh_size / sizeof(Elf64_Sym);
-	    for (i = 0; i < n; i++) {
-		if (symbol_table[i].Sym64.st_shndx == SHN_UNDEF
-		    /* Skip weak symbols */
-		    && ELF64_ST_BIND(symbol_table[i].Sym64.st_info) != STB_WEAK)
-		{
-			if (strlen(&string_table[symbol_table[i].Sym64.st_name]) > 0)
-			    add_in_sym_list(&string_table[symbol_table[i].Sym64.st_name], id);
-		}
-	    }
-	}
+/* Length of qualified name of C++ function, so that its overloads share it.
+ * Returns 0 if symbol is not understood
+ */
+static size_t qualified_name_len(const unsigned char *symbol) {
+
+    const unsigned char *p = symbol + 2;
+    char *end;
+    unsigned long len;
+
+    if (strncmp(symbol, "_Z", 2))
+	return 0;
+
+    if (*p != 'N') {
+	len = strtoul(p, &end, 10);
+	if (len == 0 || strnlen(end, len) < len)
+	    return 0;
+	return end + len - (const char *)symbol;
     }
 
-    /* Look for required symbols */
-    if (id != 0) {
-	if (g_elf_class == ELFCLASS32) {
-	    n = dynsym->Shdr32.sh_size / sizeof(Elf32_Sym);
-	    for (i = 0; i < n; i++) {
-		if (symbol_table[i].Sym32.st_shndx != SHN_UNDEF) {
-		    struct Elf_Shdr *section = section_by_index(&elf_header, symbol_table[i].Sym32.st_shndx, section_table);
-		    /* Symbol is in .data or .bss section */
-		    if (section != NULL && (section->Shdr32.sh_type == SHT_PROGBITS || section->Shdr32.sh_type == SHT_NOBITS)) {
-			struct sym_list *sym_val = g_symlist;
-			while (sym_val != NULL) {
-			    if (sym_val->lib_id == parent_id) {
-				if( !strcmp(&string_table[symbol_table[i].Sym32.st_name], sym_val->symbol)) {
-				    sym_val->found = 1;
-				    /* Print out found symbol if -v arg was supplied */
-				    if (g_verbose)
-					printf("%s%s -> %s\n", g_padding, libname, sym_val->symbol);
-				    break;
-				}
-			    }
-			    sym_val = sym_val->next;
-			}
-		    }
-		}
-	    }
-	}
-	else {
-	    n = dynsym->Shdr64.sh_size / sizeof(Elf64_Sym);
-	    for (i = 0; i < n; i++) {
-		if (symbol_table[i].Sym64.st_shndx != SHN_UNDEF) {
-		    struct Elf_Shdr *section = section_by_index(&elf_header, symbol_table[i].Sym64.st_shndx, section_table);
-		    /* Symbol is in .data or .bss section */
-		    if (section != NULL && (section->Shdr64.sh_type == SHT_PROGBITS || section->Shdr64.sh_type == SHT_NOBITS)) {
-			struct sym_list *sym_val = g_symlist;
-			while (sym_val != NULL) {
-			    if (sym_val->lib_id == parent_id) {
-				if( !strcmp(&string_table[symbol_table[i].Sym64.st_name], sym_val->symbol)) {
-				    sym_val->found = 1;
-				    /* Print out found symbol if -v arg was supplied */
-				    if (g_verbose)
-					printf("%s%s -> %s\n", g_padding, libname, sym_val->symbol);
-				    break;
-				}
-			    }
-			    sym_val = sym_val->next;
-			}
-		    }
-		}
-	    }
+    /* Nested name: qualifiers of method, then source names up to E */
+    for (p++; *p == 'r' || *p == 'V' || *p == 'K' || *p == 'R' || *p == 'O'; p++);
+    if (!strncmp(p, "St", 2))
+	p += 2;
+    while (*p != 'E') {
+	if (*p >= '0' && *p <= '9') {
+	    len = strtoul(p, &end, 10);
+	    if (len == 0 || strnlen(end, len) < len)
+		return 0;
+	    p = (const unsigned char *)end + len;
 	}
+	/* Constructors and destructors */
+	else if ((p[0] == 'C' && p[1] >= '1' && p[1] <= '3') || (p[0] == 'D' && p[1] >= '0' && p[1] <= '2'))
+	    p += 2;
+	else
+	    return 0;
+    }
+
+    return p + 1 - symbol;
+}
+
+/* Hash of the first len chars of name, as gnu_hash of whole name does */
+static inline uint32_t gnu_hash_len(const unsigned char *name, size_t len) {
+
+    uint32_t h = 5381;
+
+    while (len-- > 0)
+	h = (h << 5) + h + *name++;
+
+    return h;
+}
+
+static void providers_free(void) {
+
+    int k;
+
+    for (k = 0; k < 2; k++) {
+	free(g_providers[k]);
+	free(g_provider_pool[k]);
+	free(g_provider_libs[k]);
+	g_providers[k] = NULL;
+	g_provider_pool[k] = NULL;
+	g_provider_libs[k] = NULL;
+	g_providers_size[k] = 0;
     }
+}
+
+static inline void add_provider(int k, struct provider *val, const unsigned char *symbol, size_t key_len,
+				uint32_t hash, const struct lib_entry *lib, uint8_t similar)
+{
+    val->symbol = symbol;
+    val->key_len = key_len;
+    val->hash = hash;
+    val->lib = lib;
+    val->similar = similar;
+    val->next = g_providers[k][hash & (g_providers_size[k] - 1)];
+    g_providers[k][hash & (g_providers_size[k] - 1)] = val;
+}
 
-    /* Process shim lib */
-    if ((i = has_shim(libname)) >= 0 && !g_shimlibs[i].processed)
-	if ((n = add_in_lib_list(g_shimlibs[i].shim, parent_id)) > 0) {
-	    g_cur_depth--;
-	    /* Avoid dead loop when shim lib
-	    * depends from its counterpart
-	    */
-	    g_shimlibs[i].processed = 1;
+/* Index exports of every lib in search directories of ELF class,
+ * once per run and search directories
+ */
+static int index_providers(int k) {
+
+    size_t i, j, len, n = 0, cnt = 0, entry_cnt = 0, symdb_cnt = 0, size = 1024;
+    uint8_t elf_class = g_elf_class;
+    const unsigned char *symbol;
+    const struct cache_record *rec;
+    struct lib_entry *lib;
+    struct cache_entry *entry, **entries;
+    const struct lib_entry **libs;
+    struct provider *pool;
+    unsigned char path[PATH_MAX];
+
+    if (g_providers[k] != NULL && g_providers_gen[k] == g_lib_index_gen)
+	return 0;
+    free(g_providers[k]);
+    free(g_provider_pool[k]);
+    free(g_provider_libs[k]);
+    g_providers[k] = NULL;
+    g_provider_pool[k] = NULL;
+    g_provider_libs[k] = NULL;
+    g_providers_size[k] = 0;
+
+    len = g_lib_index_cnt[k] + g_symdb_cnt + 1;
+    entries = (struct cache_entry **)malloc(len * sizeof(struct cache_entry *));
+    libs = (const struct lib_entry **)malloc(len * sizeof(struct lib_entry *));
+    g_provider_libs[k] = (struct lib_entry *)calloc(g_symdb_cnt + 1, sizeof(struct lib_entry));
+    if (entries == NULL || libs == NULL || g_provider_libs[k] == NULL) {
+	free(entries);
+	free(libs);
+	free(g_provider_libs[k]);
+	g_provider_libs[k] = NULL;
+	return -ENOMEM;
+    }
 
-	    process_lib(g_shimlibs[i].shim, n, parent_id);
-	    g_cur_depth++;
+    /* Libs are parsed as for check, so they are shared with export index */
+    g_elf_class = k ? ELFCLASS64 : ELFCLASS32;
+    for (i = 0; i < g_lib_index_size[k]; i++)
+	for (lib = g_lib_index[k][i]; lib != NULL; lib = lib->next) {
+	    if ((entry = cache_find(lib->path)) == NULL)
+		entry = index_lib(lib->path);
+	    if (entry == NULL || entry->rec->elf_class != g_elf_class)
+		continue;
+	    entries[entry_cnt] = entry;
+	    libs[entry_cnt++] = lib;
+	    cnt += entry->rec->export_cnt;
 	}
 
-    /* Read DT_NEEDED from .dynamic section table
-     * and process required libs
+    /* Libs of symdb which are found by name, others are hidden by search directories
+     * or by the same name earlier in search order
      */
-    if (g_cur_depth <= g_depth || g_full) {
-	if (g_elf_class == ELFCLASS32) {
-	    n = dynamic->Shdr32.sh_size / sizeof(Elf32_Dyn);
-	    for (i = 0; i < n; i++) {
-		if (dynamic_table[i].Dyn32.d_tag == DT_NULL)
-		    break;
-		if (dynamic_table[i].Dyn32.d_tag == DT_NEEDED) {
-		    int new_id = add_in_lib_list(&string_table[dynamic_table[i].Dyn32.d_un.d_ptr], id);
-		    if (new_id > 0)
-			ret = process_lib(&string_table[dynamic_table[i].Dyn32.d_un.d_ptr], new_id, id);
-		}
-	    }
+    for (i = 0; g_symdb_map != NULL && i < g_symdb_cnt; i++) {
+	if (g_symdb_libs[i].elf_class != g_elf_class || (rec = symdb_record(i)) == NULL)
+	    continue;
+	lib = &g_provider_libs[k][symdb_cnt];
+	lib->name = (unsigned char *)g_symdb_map + g_symdb_libs[i].name;
+	lib->path = (unsigned char *)cache_record_path(rec);
+	if (find_lib(lib->name, path) < 0 || strcmp(path, lib->path) || (entry = cache_find(path)) == NULL)
+	    continue;
+	entries[entry_cnt] = entry;
+	libs[entry_cnt++] = lib;
+	symdb_cnt++;
+	cnt += entry->rec->export_cnt;
+    }
+    g_elf_class = elf_class;
+
+    while (size < cnt)
+	size *= 2;
+    pool = (struct provider *)malloc(2 * cnt * sizeof(struct provider) + 1);
+    g_providers[k] = (struct provider **)calloc(size, sizeof(struct provider *));
+    if (pool == NULL || g_providers[k] == NULL) {
+	free(pool);
+	free(g_providers[k]);
+	g_providers[k] = NULL;
+	free(entries);
+	free(libs);
+	return -ENOMEM;
+    }
+    g_provider_pool[k] = pool;
+    g_providers_size[k] = size;
+    g_providers_gen[k] = g_lib_index_gen;
+
+    for (i = 0; i < entry_cnt; i++)
+	for (j = 0; j < entries[i]->rec->export_cnt; j++) {
+	    symbol = entries[i]->exports[j];
+	    add_provider(k, &pool[n++], symbol, strlen(symbol), cache_record_hashes(entries[i]->rec)[j], libs[i], 0);
+	    if ((len = qualified_name_len(symbol)) != 0)
+		add_provider(k, &pool[n++], symbol, len, gnu_hash_len(symbol, len), libs[i], 1);
 	}
-	else {
-	    n = dynamic->Shdr64.sh_size / sizeof(Elf64_Dyn);
-	    for (i = 0; i < n; i++) {
-		if (dynamic_table[i].Dyn64.d_tag == DT_NULL)
-		    break;
-		if (dynamic_table[i].Dyn64.d_tag == DT_NEEDED) {
-		    int new_id = add_in_lib_list(&string_table[dynamic_table[i].Dyn64.d_un.d_ptr], id);
-		    if (new_id > 0)
-			ret = process_lib(&string_table[dynamic_table[i].Dyn64.d_un.d_ptr], new_id, id);
+
+    free(entries);
+    free(libs);
+
+    return 0;
+}
+
+/* Show libs of search directories which export symbol
+ * and other overloads of the same C++ function
+ */
+static void suggest(const struct sym_list *sym_val, int pad) {
+
+    int k = g_elf_class == ELFCLASS64;
+    size_t len, cnt = 0;
+    uint32_t hash;
+    const struct provider *val;
+    const unsigned char *demangled;
+
+    if (index_providers(k) < 0 || g_providers_size[k] == 0)
+	return;
+
+    len = strlen(sym_val->symbol);
+    for (val = g_providers[k][sym_val->hash & (g_providers_size[k] - 1)]; val != NULL; val = val->next)
+	if (!val->similar && val->hash == sym_val->hash && val->key_len == len && !strcmp(val->symbol, sym_val->symbol)) {
+	    if (++cnt == 1)
+		printf("%*sprovided by " GREEN "%s" RESET, pad, "", val->lib->name);
+	    else if (cnt <= SUGGEST_MAX)
+		printf(", " GREEN "%s" RESET, val->lib->name);
+	}
+    if (cnt > SUGGEST_MAX)
+	printf(" and %zu more", cnt - SUGGEST_MAX);
+    if (cnt > 0)
+	printf("\n");
+
+    if ((len = qualified_name_len(sym_val->symbol)) == 0)
+	return;
+
+    cnt = 0;
+    hash = gnu_hash_len(sym_val->symbol, len);
+    for (val = g_providers[k][hash & (g_providers_size[k] - 1)]; val != NULL; val = val->next)
+	if (val->similar && val->hash == hash && val->key_len == len && !strncmp(val->symbol, sym_val->symbol, len)
+	    && strcmp(val->symbol, sym_val->symbol) && ++cnt <= SUGGEST_MAX) {
+		demangled = g_demangle ? demangle(val->symbol, gnu_hash(val->symbol)) : NULL;
+		printf("%*ssimilar in %s: %s\n", pad, "", val->lib->name, demangled ? demangled : val->symbol);
+	}
+    if (cnt > SUGGEST_MAX)
+	printf("%*sand %zu more similar\n", pad, "", cnt - SUGGEST_MAX);
+}
+
+static void report(void) {
+
+    uint8_t all_found = 1;
+    struct sym_list *sym_val;
+
+    /* Check if all symbols were found */
+    sym_val = g_symlist;
+    while (sym_val != NULL) {
+	if (!sym_val->found) {
+	    all_found = 0;
+	    break;
+	}
+	sym_val = sym_val->next;
+    }
+
+    if (all_found) {
+	printf("\n" GREEN "All symbols found!" RESET "\n");
+	return;
+    }
+
+    g_unresolved_cnt[g_elf_class == ELFCLASS64]++;
+
+    printf("\nCannot locate symbols:\n");
+    sym_val = g_symlist;
+    while (sym_val != NULL) {
+	if (!sym_val->found) {
+	    const unsigned char *libname = get_lib_by_id(sym_val->lib_id);
+	    if (g_depth > 1 || g_full)
+		printf("%s -> " RED "%s" RESET "\n", libname, sym_val->symbol);
+	    else
+		printf(RED "%s" RESET "\n", sym_val->symbol);
+
+	    if (g_demangle) {
+		const unsigned char *demangled = demangle(sym_val->symbol, sym_val->hash);
+		if (demangled != NULL) {
+		    if (g_depth > 1 || g_full)
+			printf("%*s%s\n", (int)strlen(libname) + 4, "", demangled);
+		    else
+			printf("%s\n", demangled);
 		}
 	    }
+
+	    if (g_suggest)
+		suggest(sym_val, (g_depth > 1 || g_full ? strlen(libname) + 4 : 0) + 4);
 	}
+	sym_val = sym_val->next;
     }
+}
 
-    free(string_table);
-exit_symbol:
-    free(symbol_table);
-exit_dynamic:
-    free(dynamic_table);
-exit_section:
-    free(section_table);
-exit_file:
-    close(fd);
-exit:
-    g_cur_depth--;
-    return ret;
+static int cmp_diff_lib(const void *a, const void *b) {
+
+    const struct diff_lib *x = a, *y = b;
+    int ret;
+
+    if (x->entry->rec->elf_class != y->entry->rec->elf_class)
+	return x->entry->rec->elf_class < y->entry->rec->elf_class ? -1 : 1;
+    if ((ret = strcmp(x->name, y->name)))
+	return ret;
+
+    return x->order < y->order ? -1 : x->order > y->order;
 }
 
-static void add_dir(const unsigned char *parent_path, const unsigned char *dir) {
+static int cmp_diff_export(const void *a, const void *b) {
+
+    const struct diff_export *x = a, *y = b;
 
-    sprintf(g_paths[g_path_cnt], "%s%s", parent_path, dir);
-    if (!access(g_paths[g_path_cnt], F_OK))
-	g_path_cnt++;
+    if (x->elf_class != y->elf_class)
+	return x->elf_class < y->elf_class ? -1 : 1;
+    if (x->hash != y->hash)
+	return x->hash < y->hash ? -1 : 1;
+
+    return strcmp(x->symbol, y->symbol);
 }
 
-static int strpos(const char *str, const char *substr) {
+/* Exports of indexed lib are sorted by hash and name */
+static inline int cmp_lib_exports(const struct cache_entry *x, size_t i, const struct cache_entry *y, size_t j) {
 
-    char *ret = strstr(str, substr);
-    if (ret == NULL)
-	return -1;
-    else
-	return ret - str;
+    uint32_t a = cache_record_hashes(x->rec)[i], b = cache_record_hashes(y->rec)[j];
+
+    if (a != b)
+	return a < b ? -1 : 1;
+
+    return strcmp(x->exports[i], y->exports[j]);
 }
 
-static unsigned char* str_replace(unsigned char *str, const unsigned char *substr,
-						const unsigned char *replace)
-{
-    static unsigned char buf[PATH_MAX];
-    size_t len;
-    int pos;
+/* Index every ELF file of directories of system tree, files are appended to targets */
+static void diff_index(const unsigned char *root, const char * const *dirs, size_t dir_cnt, size_t *first) {
 
-    pos = strpos(str, substr);
-    if (pos < 0 || (strlen(str) - strlen(substr) + strlen(replace)) >= PATH_MAX)
-	return str;
+    size_t i;
+    unsigned char path[PATH_MAX];
 
-    len = strlen(substr);
-    strncpy(buf, str, pos);
-    sprintf(buf + pos, "%s%s", replace, str + pos + len);
-    return buf;
+    *first = g_target_cnt;
+    for (i = 0; i < dir_cnt; i++) {
+	snprintf(path, PATH_MAX, "%s/%s", root, dirs[i]);
+	if (!access_path(path, F_OK))
+	    add_target_dir(path);
+    }
+
+    prefetch(g_targets + *first, g_target_cnt - *first);
 }
 
-static unsigned char* get_lib_by_id(uint16_t lib_id) {
+static const struct cache_entry* diff_entry(const unsigned char *path) {
 
-    uint16_t k = 0;
-    struct lib_list *lib_val = g_liblist;
+    const struct cache_entry *entry;
 
-    while (lib_val != NULL) {
-	if (k == lib_id)
-	    return lib_val->name;
-	lib_val = lib_val->next;
-	k++;
+    entry = cache_find(path);
+    if (entry == NULL) {
+	g_elf_class = ELFCLASSNONE;
+	entry = index_lib(path);
     }
 
-    return NULL;
+    return entry;
 }
 
-static void usage(char * program_name) {
+/* Shared objects of search directories of system tree sorted by class and name,
+ * only the first one in search order is kept for each name
+ */
+static size_t diff_libs(const unsigned char *root, struct diff_lib **libs) {
+
+    static const char * const dirs[] = { "vendor/lib", "vendor/lib64", "lib", "lib64" };
+    size_t i, t, n = 0, first;
+    const struct cache_entry *entry;
+
+    diff_index(root, dirs, ARRAY_SIZE(dirs), &first);
+
+    *libs = (struct diff_lib *)malloc((g_target_cnt - first + 1) * sizeof(struct diff_lib));
+    if (*libs == NULL)
+	return 0;
+
+    for (t = first; t < g_target_cnt; t++) {
+	if ((entry = diff_entry(g_targets[t])) == NULL)
+	    continue;
+	(*libs)[n].name = strrchr(g_targets[t], '/') + 1;
+	(*libs)[n].path = g_targets[t] + strlen(root) + 1;
+	(*libs)[n].order = n;
+	(*libs)[n].entry = entry;
+	n++;
+    }
 
-    printf("Usage: %s [option(s)] <file>\n", program_name);
-    printf(" Lists external symbols of prebuilt proprietary ELF <file> which\n"
-	" were not found in needed compiled Android's shared objects.\n"
-	" <file> assumed to be in out/target/product//system/bin/ or\n"
-	"			 out/target/product//system/lib*/ or\n"
-	"			 out/target/product//system/vendor/lib*/\n");
-    printf(" The options are:\n");
-    printf(" -v, --verbose		Show found symbols\n");
-    printf(" -s, --silent		Show result only\n");
-    printf(" --depth <n>		Set recursion depth to <n>, default value is 1\n");
-    printf(" --full			Full depth recursion\n");
-    printf(" -i <path>		Include custom paths where to look for needed shared objects\n");
-    printf("			Use colon-separated list in case of multiple values\n");
-    printf(" --shim <lib|shim>	Supply shim counterpart for shared object\n");
-    printf("			Use colon-separated list in case of multiple values\n");
-    printf(" --demangle		Decode low-level symbol names into user-level names\n");
-    printf(" -h, --help		Display this information\n\n");
-    printf("Report bugs to: https://github.com/Kostyan-nsk/symdep/issues\n");
+    qsort(*libs, n, sizeof(struct diff_lib), cmp_diff_lib);
+    for (i = 0, t = 0; i < n; i++)
+	if (t == 0 || (*libs)[t - 1].entry->rec->elf_class != (*libs)[i].entry->rec->elf_class
+	    || strcmp((*libs)[t - 1].name, (*libs)[i].name))
+		(*libs)[t++] = (*libs)[i];
+
+    return t;
 }
 
-int main(int argc, char **argv) {
+/* Object breaks on vanished export if it needs the lib directly
+ * or if no lib of new tree exports the symbol anymore
+ */
+static int diff_breaks(const struct cache_entry *entry, struct diff_export *val,
+		const struct diff_lib *libs, size_t lib_cnt)
+{
+    size_t i;
 
-    int i, id, ret;
-    uint8_t g_demangle = 0, all_found = 1;
-    unsigned char *home, *full_path, name[NAME_MAX], parent_path[PATH_MAX];
-    struct sym_list *sym_val;
+    for (i = 0; i < entry->rec->needed_cnt; i++)
+	if (!strcmp(entry->needed[i], val->lib->name))
+	    return 1;
 
-    if (argc < 2) {
-	usage(*argv);
-	return EINVAL;
+    if (val->provided < 0) {
+	val->provided = 0;
+	for (i = 0; i < lib_cnt && !val->provided; i++)
+	    if (libs[i].entry->rec->elf_class == val->elf_class)
+		val->provided = cache_has_export(libs[i].entry, val->symbol, val->hash);
     }
 
-    home = getenv("HOME");
+    return !val->provided;
+}
+
+static void diff_symbol(const unsigned char *prefix, const unsigned char *symbol, uint32_t hash) {
+
+    const unsigned char *demangled;
+
+    printf("    %s" RED "%s" RESET "\n", prefix, symbol);
+    if (g_demangle && (demangled = demangle(symbol, hash)) != NULL)
+	printf("    %*s%s\n", (int)strlen(prefix), "", demangled);
+}
+
+/* Merge-join exports of the same libs of old and new trees,
+ * then look up imports of every object of new tree in vanished exports
+ */
+static int diff_trees(void) {
+
+    static const char * const dirs[] = {
+	"bin", "xbin", "lib", "lib/hw", "lib64", "lib64/hw",
+	"vendor/bin", "vendor/lib", "vendor/lib/hw", "vendor/lib64", "vendor/lib64/hw",
+    };
+    struct diff_lib *libs[2];
+    size_t cnt[2], i, j, e, f, t, first, lib_first, removed_cnt = 0, removed_size = 0,
+	changed_cnt = 0, affected_cnt = 0;
+    struct diff_export *removed = NULL, *val, *end, key;
+    const struct cache_entry *old, *new, *entry;
+    unsigned char prefix[NAME_MAX + 8];
+    uint8_t affected;
+    int c, ret = 0;
+
+    cnt[0] = diff_libs(g_diff[0], &libs[0]);
+    cnt[1] = diff_libs(g_diff[1], &libs[1]);
+    if (libs[0] == NULL || libs[1] == NULL) {
+	ret = ENOMEM;
+	goto exit;
+    }
+
+    for (i = 0, j = 0; i < cnt[0]; ) {
+	c = j < cnt[1] ? libs[0][i].entry->rec->elf_class - libs[1][j].entry->rec->elf_class : -1;
+	if (c == 0)
+	    c = strcmp(libs[0][i].name, libs[1][j].name);
+	if (c > 0) {
+	    j++;
+	    continue;
+	}
+
+	old = libs[0][i].entry;
+	new = c == 0 ? libs[1][j].entry : NULL;
+	lib_first = removed_cnt;
+	for (e = 0, f = 0; e < old->rec->export_cnt; e++) {
+	    while (new != NULL && f < new->rec->export_cnt && cmp_lib_exports(new, f, old, e) < 0)
+		f++;
+	    if (new != NULL && f < new->rec->export_cnt && !cmp_lib_exports(new, f, old, e))
+		continue;
+
+	    if (removed_cnt == removed_size) {
+		removed_size = removed_size ? removed_size * 2 : 1024;
+		val = (struct diff_export *)realloc(removed, removed_size * sizeof(struct diff_export));
+		if (val == NULL) {
+		    ret = ENOMEM;
+		    goto exit;
+		}
+		removed = val;
+	    }
+	    val = &removed[removed_cnt++];
+	    val->hash = cache_record_hashes(old->rec)[e];
+	    val->elf_class = old->rec->elf_class;
+	    val->provided = -1;
+	    val->symbol = old->exports[e];
+	    val->lib = &libs[0][i];
+	}
+
+	if (removed_cnt > lib_first || new == NULL) {
+	    changed_cnt++;
+	    if (!g_silent && changed_cnt == 1)
+		printf("Vanished exports:\n");
+	    if (!g_silent && new == NULL)
+		printf("%s: " RED "Removed" RESET "\n", libs[0][i].path);
+	    else if (!g_silent) {
+		printf("%s\n", libs[0][i].path);
+		for (e = lib_first; e < removed_cnt; e++)
+		    diff_symbol("", removed[e].symbol, removed[e].hash);
+	    }
+	}
+
+	i++;
+	if (c == 0)
+	    j++;
+    }
+
+    qsort(removed, removed_cnt, sizeof(struct diff_export), cmp_diff_export);
+
+    /* Objects of new tree whose imports intersect vanished exports */
+    first = g_target_cnt;
+    if (removed_cnt)
+	diff_index(g_diff[1], dirs, ARRAY_SIZE(dirs), &first);
+    for (t = first; t < g_target_cnt; t++) {
+	if ((entry = diff_entry(g_targets[t])) == NULL)
+	    continue;
+
+	affected = 0;
+	for (e = 0; e < entry->rec->import_cnt; e++) {
+	    key.hash = gnu_hash(entry->imports[e]);
+	    key.elf_class = entry->rec->elf_class;
+	    key.symbol = entry->imports[e];
+	    val = bsearch(&key, removed, removed_cnt, sizeof(struct diff_export), cmp_diff_export);
+	    if (val == NULL)
+		continue;
+
+	    /* Symbol may vanish from several libs */
+	    while (val > removed && !cmp_diff_export(val - 1, &key))
+		val--;
+	    for (end = removed + removed_cnt; val < end && !cmp_diff_export(val, &key); val++) {
+		if (!diff_breaks(entry, val, libs[1], cnt[1]))
+		    continue;
+		if (!affected++) {
+		    affected_cnt++;
+		    if (!g_silent)
+			printf("%s%s\n", affected_cnt == 1 ? "\nAffected objects:\n" : "", g_targets[t]);
+		}
+		if (!g_silent) {
+		    snprintf(prefix, sizeof(prefix), "%s -> ", val->lib->name);
+		    diff_symbol(prefix, val->symbol, val->hash);
+		}
+	    }
+	}
+    }
+
+    printf("\n%zu exports vanished from %zu shared objects, %s%zu objects affected" RESET "\n",
+	    removed_cnt, changed_cnt, affected_cnt ? RED : GREEN, affected_cnt);
+
+exit:
+    free(libs[0]);
+    free(libs[1]);
+    free(removed);
+
+    return ret;
+}
+
+static int check_target(const unsigned char *target) {
+
+    int id, ret;
+    unsigned char *full_path, name[PATH_MAX];
+    struct stats_time t;
+
+    full_path = real_path(str_replace((unsigned char *)target, "~", g_home));
+    if (full_path == NULL || access_path(full_path, R_OK) < 0) {
+	ret = errno;
+	printf("%s: " RED "%s" RESET "\n", target, strerror(ret));
+	free(full_path);
+	return ret;
+    }
+
+    reset_lists();
+    add_target_dirs(full_path);
+
+    if (g_inotify >= 0) {
+	strcpy(name, full_path);
+	watch_dir(dirname(name));
+    }
+
+    /* Tell targets apart in silent batch report */
+    if (g_silent && g_target_cnt > 1)
+	printf("%s\n", target);
+
+    strcpy(name, target);
+    id = add_in_lib_list(basename(name), 0);
+    if (id < 0) {
+	free(full_path);
+	return errno;
+    }
+
+    /* Whole tree is prefetched at once in sweep mode */
+    if (g_sweep == NULL) {
+	stats_start(&t);
+	prefetch(&full_path, 1);
+	stats_phase(PHASE_PREFETCH, &t);
+    }
+
+    /* And here we go in */
+    if (g_global)
+	ret = process_global(full_path);
+    else
+	ret = process_lib(full_path, id, 0);
+    free(full_path);
+
+    if (g_target_status == TARGET_INVALID)
+	return EXIT_FAILURE;
+    g_checked_cnt[g_elf_class == ELFCLASS64]++;
+    if (g_target_status == TARGET_OK)
+	report();
+
+    return ret;
+}
+
+/* Returns -1 if checks should be run, otherwise exit code */
+static int parse_args(int argc, char **argv) {
+
+    int i, k, err;
+    struct stat st;
 
     /* Parsing arguments */
     for (i = 1; i < argc; i++) {
@@ -804,42 +6266,62 @@ int main(int argc, char **argv) {
 	    g_verbose = 1;
 
 	/* Silent */
-	if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--silent"))
+	else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--silent"))
 	    g_silent = 1;
 
 	/* Help */
-	if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+	else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
 	    usage(*argv);
 	    return 0;
 	}
 
 	/* Full depth recursion */
-	if (!strcmp(argv[i], "--full"))
+	else if (!strcmp(argv[i], "--full"))
 	    g_full = 1;
 
+	/* Resolve against whole load set */
+	else if (!strcmp(argv[i], "--global"))
+	    g_global = 1;
+
 	/* Resolve symbol names */
-	if (!strcmp(argv[i], "--demangle"))
+	else if (!strcmp(argv[i], "--demangle"))
 	    g_demangle = 1;
 
+	/* Look for providers of missing symbols */
+	else if (!strcmp(argv[i], "--suggest"))
+	    g_suggest = 1;
+
+	/* Persistent export index */
+	else if (!strcmp(argv[i], "--cache"))
+	    g_keep_cache = 1;
+
+	/* Timings and counters */
+	else if (!strcmp(argv[i], "--stats"))
+	    g_stats = 1;
+
 	/* Recursion depth */
-	if (!strcmp(argv[i], "--depth")) {
+	else if (!strcmp(argv[i], "--depth")) {
 	    if (i + 1 == argc) {
 		printf("Missing value for argument \"--depth\"\n");
 		return EINVAL;
 	    }
 	    else {
 		char *pEnd;
-		g_depth = strtol(argv[i + 1], &pEnd, 0);
-		if (g_depth <= 0 || errno == ERANGE) {
+		long depth;
+
+		errno = 0;
+		depth = strtol(argv[i + 1], &pEnd, 0);
+		if (depth <= 0 || depth > INT_MAX || errno == ERANGE || *pEnd != '\0') {
 		    printf("Invalid value for argument \"--depth\"\n");
 		    return EINVAL;
 		}
+		g_depth = depth;
 		i++;
 	    }
 	}
 
 	/* Custom directories */
-	if (!strcmp(argv[i], "-i")) {
+	else if (!strcmp(argv[i], "-i")) {
 	    if (i + 1 == argc) {
 		printf("Missing value for argument \"-i\"\n");
 		return EINVAL;
@@ -847,13 +6329,7 @@ int main(int argc, char **argv) {
 	    else {
 		char *p = strtok(argv[i + 1], ":");
 		while (p != NULL) {
-		    if ((full_path = realpath(str_replace(p, "~", home), NULL)) == NULL)
-			printf("Warning: \"%s\": %s\n", p, strerror(errno));
-		    else {
-			add_dir(full_path, "");
-			free(full_path);
-			g_cust_path++;
-		    }
+		    add_custom_dir(p);
 		    p = strtok(NULL, ":");
 		}
 		i++;
@@ -861,133 +6337,617 @@ int main(int argc, char **argv) {
 	}
 
 	/* Shim libs */
-	if (!strcmp(argv[i], "--shim"))
+	else if (!strcmp(argv[i], "--shim")) {
 	    if (i + 1 == argc) {
 		printf("Missing value for argument \"-s\"\n");
 		return EINVAL;
 	    }
-	else {
-	    char *p = strtok(argv[i + 1], ":");
-	    if (p != NULL) {
-		while (p != NULL) {
-		    if (strstr(p, "|") != NULL) {
-			strncpy(g_shimlibs[g_shim_cnt].lib, p, strpos(p, "|"));
-			strcpy(g_shimlibs[g_shim_cnt].shim, strpbrk(p, "|") + 1);
-			g_shimlibs[g_shim_cnt].processed = 0;
-			g_shim_cnt++;
+	    else {
+		char *p = strtok(argv[i + 1], ":");
+		if (p != NULL) {
+		    while (p != NULL) {
+			char *shim = strchr(p, '|');
+			if (shim != NULL) {
+			    *shim++ = '\0';
+			    if ((err = add_shim(p, shim)) == -ENOMEM)
+				return ENOMEM;
+			    if (err < 0)
+				printf("Warning: Invalid value for argument \"--shim\": %s|%s\n", p, shim);
+			}
+			else
+			    printf("Warning: Invalid value for argument \"--shim\": %s\n", p);
+			p = strtok(NULL, ":");
 		    }
-		    else
-			printf("Warning: Invalid value for argument \"--shim\": %s\n", p);
-		    p = strtok(NULL, ":");
 		}
+		else {
+		    printf("Invalid value for argument \"--shim\"\n");
+		    return EINVAL;
+		}
+		i++;
+	    }
+	}
+
+	/* Number of threads */
+	else if (!strcmp(argv[i], "-j")) {
+	    if (i + 1 == argc) {
+		printf("Missing value for argument \"-j\"\n");
+		return EINVAL;
 	    }
 	    else {
-		printf("Invalid value for argument \"--shim\"\n");
+		char *pEnd;
+		long jobs = strtol(argv[i + 1], &pEnd, 0);
+		if (jobs <= 0 || jobs > 1024 || *pEnd != '\0') {
+		    printf("Invalid value for argument \"-j\"\n");
+		    return EINVAL;
+		}
+		g_jobs = jobs;
+		i++;
+	    }
+	}
+
+	/* Whole system tree */
+	else if (!strcmp(argv[i], "--sweep")) {
+	    if (i + 1 == argc) {
+		printf("Missing value for argument \"--sweep\"\n");
+		return EINVAL;
+	    }
+	    g_sweep = system_root(argv[i + 1]);
+	    if (g_sweep == NULL) {
+		printf("%s: " RED "%s" RESET "\n", argv[i + 1], strerror(errno));
+		return errno;
+	    }
+	    if ((err = add_sweep_dirs(g_sweep)) < 0) {
+		printf("%s: " RED "%s" RESET "\n", argv[i + 1], strerror(-err));
+		return -err;
+	    }
+	    i++;
+	}
+
+	/* Daemon options are handled in main */
+	else if (!strcmp(argv[i], "--serve") || !strcmp(argv[i], "--client"))
+	    continue;
+	else if (!strcmp(argv[i], "--socket"))
+	    i++;
+
+	/* Shims and custom directories listed in file */
+	else if (!strcmp(argv[i], "--manifest")) {
+	    if (i + 1 == argc) {
+		printf("Missing value for argument \"--manifest\"\n");
+		return EINVAL;
+	    }
+	    if ((err = add_manifest(str_replace(argv[i + 1], "~", g_home))) < 0) {
+		printf("%s: " RED "%s" RESET "\n", argv[i + 1], strerror(-err));
+		return -err;
+	    }
+	    i++;
+	}
+
+	/* Symbol database of ROM */
+	else if (!strcmp(argv[i], "--symdb")) {
+	    if (i + 1 == argc) {
+		printf("Missing value for argument \"--symdb\"\n");
+		return EINVAL;
+	    }
+	    free(g_symdb);
+	    g_symdb = strdup(str_replace(argv[i + 1], "~", g_home));
+	    if (g_symdb == NULL)
+		return ENOMEM;
+	    i++;
+	}
+
+	/* Create symbol database from system tree */
+	else if (!strcmp(argv[i], "--make-symdb")) {
+	    if (i + 1 == argc) {
+		printf("Missing value for argument \"--make-symdb\"\n");
+		return EINVAL;
+	    }
+	    free(g_make_symdb);
+	    g_make_symdb = system_root(argv[i + 1]);
+	    if (g_make_symdb == NULL) {
+		printf("%s: " RED "%s" RESET "\n", argv[i + 1], strerror(errno));
+		return errno;
+	    }
+	    i++;
+	}
+
+	/* Compare exports of two system trees */
+	else if (!strcmp(argv[i], "--diff")) {
+	    if (i + 2 >= argc) {
+		printf("Missing value for argument \"--diff\"\n");
+		return EINVAL;
+	    }
+	    for (k = 0; k < 2; k++) {
+		free(g_diff[k]);
+		g_diff[k] = system_root(argv[i + 1 + k]);
+		if (g_diff[k] == NULL) {
+		    printf("%s: " RED "%s" RESET "\n", argv[i + 1 + k], strerror(errno));
+		    return errno;
+		}
+	    }
+	    i += 2;
+	}
+
+	/* List of targets */
+	else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--list")) {
+	    if (i + 1 == argc) {
+		printf("Missing value for argument \"--list\"\n");
 		return EINVAL;
 	    }
+	    if ((err = add_target_list(str_replace(argv[i + 1], "~", g_home))) < 0) {
+		printf("%s: " RED "%s" RESET "\n", argv[i + 1], strerror(-err));
+		return -err;
+	    }
 	    i++;
 	}
+
+	/* Target file or directory */
+	else {
+	    err = 0;
+	    if (!stat_path(str_replace(argv[i], "~", g_home), &st) && S_ISDIR(st.st_mode))
+		err = add_target_dir(str_replace(argv[i], "~", g_home));
+	    else
+		err = add_target(argv[i]);
+	    if (err < 0) {
+		printf("%s: " RED "%s" RESET "\n", argv[i], strerror(-err));
+		return -err;
+	    }
+	}
+    }
+
+    return -1;
+}
+
+static int run_checks(void) {
+
+    int i, ret = 0, err;
+    uint8_t multilib;
+    size_t t, unresolved;
+    struct stats_time start, prefetch_time;
+
+    if (g_make_symdb != NULL)
+	return make_symdb();
+
+    if (g_diff[0] != NULL)
+	return diff_trees();
+
+    if (g_target_cnt == 0) {
+	usage(g_program);
+	return EINVAL;
     }
 
     /* Silent overrides Verbose */
     if (g_silent)
 	g_verbose = 0;
 
-    /* Assume the last parameter is target lib name */
-    full_path = realpath(str_replace(argv[argc - 1], "~", home), NULL);
-    if (access(full_path, R_OK) < 0) {
-	printf("%s: " RED "%s" RESET "\n", argv[argc - 1], strerror(errno));
-	return errno;
+    if ((err = index_shims()) < 0)
+	return -err;
+
+    /* Parsed libs are shared between targets and threads */
+    g_use_cache = g_keep_cache || g_target_cnt > 1 || g_jobs > 1 || g_serving || g_global || g_symdb != NULL;
+
+    /* Daemon loads index once */
+    if (g_keep_cache && !g_serving && (i = cache_load()) < 0 && i != -ENOENT && !g_silent)
+	printf("Warning: Export index \"%s\" is ignored: %s\n", g_cache_path, strerror(-i));
+
+    if ((err = symdb_open()) < 0) {
+	printf("%s: " RED "%s" RESET "\n", g_symdb, strerror(-err));
+	return -err;
     }
 
-    /* Parsing paths */
-    strcpy(name, basename(dirname(full_path)));
-    strcpy(parent_path, dirname(full_path));
-    free(full_path);
+    if (g_stats)
+	stats_reset();
+    stats_start(&start);
 
-    /* Assume target ELF object is in
-     *     system/vendor/bin
-     *     system/vendor/sbin
-     *     system/vendor/xbin
-     *     system/vendor/lib
-     *     system/vendor/lib64
-     *     system/vendor/lib/hw
-     *     system/vendor/lib64/hw
-     *     system/lib
-     *     system/lib64
-     *     system/lib/hw
-     *     system/lib64/hw
-     * directories
+    if (g_sweep != NULL) {
+	/* Search directories are the same for every object of the tree */
+	add_target_dirs(g_targets[0]);
+	prefetch_time = start;
+	prefetch(g_targets, g_target_cnt);
+	stats_phase(PHASE_PREFETCH, &prefetch_time);
+    }
+
+    readahead_start();
+    for (t = 0; t < g_target_cnt; t++) {
+	if (t > 0)
+	    printf("\n");
+	err = check_target(g_targets[t]);
+	if (err)
+	    ret = err;
+    }
+    readahead_stop();
+
+    /* Each ELF class is resolved against its own libs,
+     * but both are summed up in one report
      */
-    // In case if we are in "lib*/hw" directory
-    if((!strcmp(basename(parent_path), "lib") || !strcmp(basename(parent_path), "lib64"))
-	&& !strcmp(name, "hw"))
-	    strcpy(parent_path, dirname(parent_path));
-    if (!strcmp(name, "lib") || !strcmp(name, "lib64") || !strcmp(name, "hw")
-	|| !strcmp(name, "bin") || !strcmp(name, "sbin") || !strcmp(name, "xbin")) {
+    unresolved = g_unresolved_cnt[0] + g_unresolved_cnt[1];
+    multilib = g_checked_cnt[0] && g_checked_cnt[1];
+    if (g_sweep != NULL || multilib)
+	printf("\n%zu objects checked, %s%zu with missing symbols" RESET "\n", g_target_cnt,
+		unresolved ? RED : GREEN, unresolved);
+    if (multilib)
+	for (i = 0; i < 2; i++)
+	    printf("  ELF%d: %zu objects checked, %s%zu with missing symbols" RESET "\n", i ? 64 : 32,
+		    g_checked_cnt[i], g_unresolved_cnt[i] ? RED : GREEN, g_unresolved_cnt[i]);
+
+    if (g_stats) {
+	fflush(stdout);
+	stats_report(&start);
+    }
 
-	    /* In case if we are in system/vendor/lib* directory */
-	    if( !strcmp(basename(parent_path), "vendor"))
-		strcpy(parent_path, dirname(parent_path));
+    if (g_keep_cache && (i = cache_save()) < 0)
+	printf("Warning: Unable to save export index \"%s\": %s\n", g_cache_path, strerror(-i));
 
-	    if( !strcmp(basename(parent_path), "system")) {
-		add_dir(parent_path, "/vendor/lib");
-		add_dir(parent_path, "/vendor/lib64");
-		add_dir(parent_path, "/lib");
-		add_dir(parent_path, "/lib64");
-	    }
+    /* Reverse index points into export index, which may change until next run */
+    providers_free();
+
+    return ret;
+}
+
+/* Forget options of previous request */
+static void reset_options(void) {
+
+    size_t t;
+
+    g_verbose = 0;
+    g_silent = 0;
+    g_full = 0;
+    g_global = 0;
+    g_demangle = 0;
+    g_suggest = 0;
+    g_stats = 0;
+    g_depth = 1;
+    g_path_cnt = 0;
+    g_cust_path = 0;
+    g_shim_cnt = 0;
+    g_jobs = 1;
+    g_keep_cache = g_serve_cache;
+    memset(g_checked_cnt, 0, sizeof(g_checked_cnt));
+    memset(g_unresolved_cnt, 0, sizeof(g_unresolved_cnt));
+
+    for (t = 0; t < g_target_cnt; t++)
+	free(g_targets[t]);
+    g_target_cnt = 0;
+
+    free(g_sweep);
+    g_sweep = NULL;
+    free(g_symdb);
+    g_symdb = NULL;
+    free(g_make_symdb);
+    g_make_symdb = NULL;
+    for (t = 0; t < 2; t++) {
+	free(g_diff[t]);
+	g_diff[t] = NULL;
     }
+}
 
-    strcpy(name, argv[argc - 1]);
-    id = add_in_lib_list(basename(name), 0);
-    if (id < 0)
+static int read_full(int fd, void *buf, size_t size) {
+
+    ssize_t n;
+    unsigned char *p = buf;
+
+    while (size > 0) {
+	n = read(fd, p, size);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return -EIO;
+	p += n;
+	size -= n;
+    }
+
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t size) {
+
+    ssize_t n;
+    const unsigned char *p = buf;
+
+    while (size > 0) {
+	n = write(fd, p, size);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return -EIO;
+	p += n;
+	size -= n;
+    }
+
+    return 0;
+}
+
+/* Request: u32 length and working directory, u32 argc, then u32 length and
+ * value of each argument.
+ * Reply: i32 exit code, u32 length and output
+ */
+static int write_string(int fd, const unsigned char *str) {
+
+    uint32_t len = strlen(str);
+
+    if (write_full(fd, &len, sizeof(len)) < 0)
+	return -EIO;
+    return write_full(fd, str, len);
+}
+
+static unsigned char* read_string(int fd) {
+
+    uint32_t len;
+    unsigned char *str;
+
+    if (read_full(fd, &len, sizeof(len)) < 0 || len >= 1 << 20)
+	return NULL;
+
+    str = (unsigned char *)malloc(len + 1);
+    if (str == NULL)
+	return NULL;
+    if (read_full(fd, str, len) < 0) {
+	free(str);
+	return NULL;
+    }
+    str[len] = '\0';
+
+    return str;
+}
+
+static void serve_request(int conn) {
+
+    int32_t ret = EINVAL;
+    uint32_t i, argc = 0, len;
+    unsigned char *cwd, **argv = NULL;
+    char *output = NULL;
+    size_t output_size = 0;
+    FILE *out, *saved_stdout;
+
+    cwd = read_string(conn);
+    if (cwd == NULL || read_full(conn, &argc, sizeof(argc)) < 0 || argc == 0 || argc > 4096)
+	goto exit;
+
+    argv = (unsigned char **)calloc(argc + 1, sizeof(unsigned char *));
+    if (argv == NULL)
+	goto exit;
+    for (i = 0; i < argc; i++)
+	if ((argv[i] = read_string(conn)) == NULL)
+	    goto exit;
+
+    out = open_memstream(&output, &output_size);
+    if (out == NULL)
+	goto exit;
+
+    /* Relative targets are given with respect to client */
+    if (chdir(cwd) < 0) {
+	fprintf(out, "%s: " RED "%s" RESET "\n", cwd, strerror(errno));
+	ret = errno;
+    }
+    else {
+	reset_options();
+	saved_stdout = stdout;
+	stdout = out;
+	ret = parse_args(argc, (char **)argv);
+	if (ret < 0)
+	    ret = run_checks();
+	stdout = saved_stdout;
+	/* Images are mounted again next time, they may be rebuilt meanwhile */
+	vfs_close();
+    }
+    fclose(out);
+
+    len = output_size;
+    if (!write_full(conn, &ret, sizeof(ret)) && !write_full(conn, &len, sizeof(len)))
+	write_full(conn, output, len);
+
+exit:
+    if (argv != NULL)
+	for (i = 0; i < argc; i++)
+	    free(argv[i]);
+    free(argv);
+    free(cwd);
+    free(output);
+}
+
+static void stop_serving(int sig) {
+
+    (void)sig;
+    g_stop = 1;
+}
+
+static void default_socket_path(void) {
+
+    unsigned char *runtime;
+
+    if (g_socket_path[0] != '\0')
+	return;
+
+    runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime != NULL && *runtime != '\0')
+	snprintf(g_socket_path, sizeof(g_socket_path), "%s/symdep.sock", runtime);
+    else
+	snprintf(g_socket_path, sizeof(g_socket_path), "/tmp/symdep-%u.sock", getuid());
+}
+
+/* Keep export index in memory and check targets on behalf of clients */
+static int serve(void) {
+
+    int i, sock, conn, ret = 0;
+    struct sockaddr_un addr;
+    struct pollfd fds[2];
+    struct sigaction sa;
+
+    default_socket_path();
+
+    if (g_keep_cache && (i = cache_load()) < 0 && i != -ENOENT)
+	printf("Warning: Export index \"%s\" is ignored: %s\n", g_cache_path, strerror(-i));
+
+    g_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_inotify < 0)
+	printf("Warning: Changes of shared objects are not watched: %s\n", strerror(errno));
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+	printf(RED "%s" RESET "\n", strerror(errno));
 	return errno;
+    }
 
-    full_path = realpath(str_replace(argv[argc - 1], "~", home), NULL);
-    /* And here we go in */
-    ret = process_lib(full_path, id, 0);
-    free(full_path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, g_socket_path);
+    unlink(g_socket_path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+	ret = errno;
+	printf("%s: " RED "%s" RESET "\n", g_socket_path, strerror(ret));
+	close(sock);
+	return ret;
+    }
 
-    /* Check if all symbols were found */
-    sym_val = g_symlist;
-    while (sym_val != NULL) {
-	if (!sym_val->found) {
-	    all_found = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_serving;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Listening on %s\n", g_socket_path);
+    fflush(stdout);
+
+    while (!g_stop) {
+	fds[0].fd = sock;
+	fds[0].events = POLLIN;
+	fds[1].fd = g_inotify;
+	fds[1].events = POLLIN;
+	if (poll(fds, g_inotify >= 0 ? 2 : 1, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    ret = errno;
 	    break;
 	}
-	sym_val = sym_val->next;
+
+	if (g_inotify >= 0 && (fds[1].revents & POLLIN))
+	    read_watches();
+
+	if (fds[0].revents & POLLIN) {
+	    conn = accept(sock, NULL, NULL);
+	    if (conn < 0)
+		continue;
+	    /* Pick up changes made right before request */
+	    read_watches();
+	    serve_request(conn);
+	    close(conn);
+	}
     }
 
-    if (all_found) {
-	printf("\n" GREEN "All symbols found!" RESET "\n");
+    close(sock);
+    unlink(g_socket_path);
+
+    if (g_keep_cache && (i = cache_save()) < 0)
+	printf("Warning: Unable to save export index \"%s\": %s\n", g_cache_path, strerror(-i));
+
+    return ret;
+}
+
+/* Pass arguments to daemon and print its report */
+static int client(int argc, char **argv) {
+
+    int i, sock;
+    int32_t ret;
+    uint32_t cnt = 0, len;
+    unsigned char cwd[PATH_MAX], buf[4096];
+    struct sockaddr_un addr;
+
+    default_socket_path();
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+	printf(RED "%s" RESET "\n", strerror(errno));
+	return errno;
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+	printf(RED "%s" RESET "\n", strerror(errno));
+	return errno;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, g_socket_path);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	ret = errno;
+	printf("%s: " RED "%s" RESET "\n", g_socket_path, strerror(ret));
+	close(sock);
 	return ret;
     }
 
-    printf("\nCannot locate symbols:\n");
-    sym_val = g_symlist;
-    while (sym_val != NULL) {
-	if (!sym_val->found) {
-	    unsigned char *libname = get_lib_by_id(sym_val->lib_id);
-	    if (g_depth > 1 || g_full)
-		printf("%s -> " RED "%s" RESET "\n", libname, sym_val->symbol);
-	    else
-		printf(RED "%s" RESET "\n", sym_val->symbol);
+    /* Daemon options are not passed */
+    for (i = 0; i < argc; i++)
+	if (!strcmp(argv[i], "--socket"))
+	    i++;
+	else if (strcmp(argv[i], "--client"))
+	    cnt++;
 
-	    if (g_demangle) {
-		unsigned char *demangled = bfd_demangle(0, sym_val->symbol, 0x101);
-		if (demangled != NULL) {
-		    if (g_depth > 1 || g_full) {
-			memset(g_padding, ' ', strlen(libname) + 4);
-			g_padding[strlen(libname) + 4] = '\0';
-			printf("%s%s\n", g_padding, demangled);
-		    }
-		    else
-			printf("%s\n", demangled);
-		}
+    if (write_string(sock, cwd) < 0 || write_full(sock, &cnt, sizeof(cnt)) < 0)
+	goto error;
+    for (i = 0; i < argc; i++)
+	if (!strcmp(argv[i], "--socket"))
+	    i++;
+	else if (strcmp(argv[i], "--client") && write_string(sock, argv[i]) < 0)
+	    goto error;
+
+    if (read_full(sock, &ret, sizeof(ret)) < 0 || read_full(sock, &len, sizeof(len)) < 0)
+	goto error;
+    while (len > 0) {
+	cnt = len < sizeof(buf) ? len : sizeof(buf);
+	if (read_full(sock, buf, cnt) < 0)
+	    goto error;
+	fwrite(buf, 1, cnt, stdout);
+	len -= cnt;
+    }
+
+    close(sock);
+    return ret;
+
+error:
+    printf("%s: " RED "%s" RESET "\n", g_socket_path, strerror(EIO));
+    close(sock);
+    return EIO;
+}
+
+int main(int argc, char **argv) {
+
+    int i, ret;
+
+    g_program = *argv;
+    if (argc < 2) {
+	usage(*argv);
+	return EINVAL;
+    }
+
+    g_home = getenv("HOME");
+
+    /* Daemon and its client take their own options first */
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "--socket")) {
+	    if (i + 1 == argc) {
+		printf("Missing value for argument \"--socket\"\n");
+		return EINVAL;
 	    }
+	    snprintf(g_socket_path, sizeof(g_socket_path), "%s", argv[++i]);
 	}
-	sym_val = sym_val->next;
+	else if (!strcmp(argv[i], "--serve"))
+	    g_serving = 1;
+	else if (!strcmp(argv[i], "--client"))
+	    g_client = 1;
     }
 
-    return ret;
+    if (g_client)
+	return client(argc, argv);
+
+    if (g_serving) {
+	for (i = 1; i < argc; i++)
+	    if (!strcmp(argv[i], "--cache"))
+		g_keep_cache = g_serve_cache = 1;
+	return serve();
+    }
+
+    ret = parse_args(argc, argv);
+    if (ret >= 0)
+	return ret;
+
+    return run_checks();
 }